@@ -192,6 +192,18 @@ void doom_init(int argc, char** argv, int flags);
 void doom_update(); // This will update at 35 FPS
 void doom_force_update(); // This will run a frame everytime it's called, regardless of FPS.
 
+// Seeks the playing demo to a tic (-seektic on the command line).
+// Going back restores the nearest snapshot before it (-snapshots
+// sets how many seconds apart they are) and plays on from there.
+// Only the last 32 snapshots of the current level are kept; a seek
+// back past those, or into an earlier level, restarts the demo and
+// replays it from tic 0, which takes as long as the demo so far.
+// Seeking to the current tic cancels a seek that is still running.
+// While doom_is_seeking(), doom_update runs tics as fast as it can
+// and there are no new frames to show.
+void doom_seek_demo(int tic);
+int doom_is_seeking();
+
 // Channels: 1 = indexed, 3 = RGB, 4 = RGBA
 const unsigned char* doom_get_framebuffer(int channels);
 
@@ -947,6 +959,28 @@ typedef struct thinker_s
 #define doom_abs(x) ((x) < 0 ? -(x) : (x))
 
 
+// Storage class for the refresh state that every render worker
+// needs its own copy of (see I_RunWorkers).
+#if defined(_MSC_VER)
+#define DOOM_THREADLOCAL __declspec(thread)
+#else
+#define DOOM_THREADLOCAL __thread
+#endif
+
+// AVX2 drawers, see R_InitDrawers.
+// Define DOOM_NO_SIMD to leave them out.
+#if !defined(DOOM_NO_SIMD) && ((defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))) || (defined(_MSC_VER) && defined(_M_X64)))
+#define DOOM_AVX2
+#endif
+
+// Hint that a pointer is about to be read.
+#if defined(__GNUC__)
+#define DOOM_PREFETCH(p) __builtin_prefetch(p)
+#else
+#define DOOM_PREFETCH(p)
+#endif
+
+
 extern char error_buf[260];
 extern int doom_flags;
 extern doom_print_fn doom_print;
@@ -1445,6 +1479,16 @@ void D_PageDrawer(void);
 void D_AdvanceDemo(void);
 void D_StartTitle(void);
 
+//
+// DEMO SEEK
+// Demo tic being fast-forwarded to, or -1.
+// Nothing is drawn or heard until it's reached.
+//
+extern int seektic;
+
+void D_SeekDemo(int tic);
+doom_boolean D_RunSeek(void);
+
 
 #endif
 #ifndef __D_TEXTUR__
@@ -1647,7 +1691,11 @@ typedef struct
 //
 
 // Indicate a leaf.
-#define NF_SUBSECTOR 0x8000
+// The NODES lump uses the top bit of a short,
+//  nodes in memory the top bit of an int, so that
+//  extended nodes can have more children.
+#define NF_MAPSUBSECTOR 0x8000
+#define NF_SUBSECTOR 0x80000000
 
 typedef struct
 {
@@ -1661,7 +1709,7 @@ typedef struct
     // clip against view frustum.
     short bbox[2][4];
 
-    // If NF_SUBSECTOR its a subsector,
+    // If NF_MAPSUBSECTOR its a subsector,
     // else it's a node of another subtree.
     unsigned short children[2];
 } mapnode_t;
@@ -1822,6 +1870,12 @@ void G_WorldDone(void);
 void G_Ticker(void);
 doom_boolean G_Responder(event_t* ev);
 
+// Demo snapshots to seek back to, see G_TakeSnapshot.
+extern int snapshotinterval;
+
+int G_SnapshotTic(int tic);
+doom_boolean G_RestoreSnapshot(int tic);
+
 void G_ScreenShot(void);
 
 
@@ -1940,6 +1994,26 @@ void I_Tactile(int on, int off, int total);
 
 void I_Error(char* error);
 
+// Worker threads, used to spread the refresh over several cores.
+// The calling thread counts as worker 0.
+#define MAXWORKERS 32
+
+extern int numworkers;
+
+// Called by R_Init when -rthreads is given.
+void I_InitWorkers(int count);
+
+// Runs job(0) .. job(numworkers-1) concurrently,
+// and returns when they have all finished.
+void I_RunWorkers(void (*job)(int worker));
+
+// Runs job on a background thread, after waiting for
+// the previous one. Without threads, it runs right away.
+void I_StartLoader(void (*job)(void));
+
+// Waits for the job given to I_StartLoader to return.
+void I_WaitLoader(void);
+
 
 #endif
 
@@ -3516,6 +3590,11 @@ void P_UnArchiveThinkers(void);
 void P_ArchiveSpecials(void);
 void P_UnArchiveSpecials(void);
 
+// In-memory snapshots of the current level.
+int P_SnapshotSize(void);
+void P_ArchiveSnapshot(void);
+void P_UnArchiveSnapshot(void);
+
 extern byte* save_p;
 
 
@@ -4043,7 +4122,7 @@ int SlopeDiv(unsigned num, unsigned den);
 // The sound code uses the x,y, and subsector fields
 // to do stereo positioning of any sound effited by the mobj_t.
 //
-// The play simulation uses the blocklinks, x,y,z, radius, height
+// The play simulation uses the blockthings, x,y,z, radius, height
 // to determine when mobj_ts are touching each other,
 // touching lines in the map, or hit by trace lines (gunshots,
 // lines of sight, etc).
@@ -4193,7 +4272,8 @@ typedef struct mobj_s
     int frame;        // might be ORed with FF_FULLBRIGHT
 
     // Interaction info, by BLOCKMAP.
-    // Links in blocks (if needed).
+    // No longer used, blocks keep their things in
+    //  blockthings, but kept for the savegame layout.
     struct mobj_s* bnext;
     struct mobj_s* bprev;
 
@@ -4748,9 +4828,15 @@ extern doom_boolean usergame;
 extern doom_boolean demoplayback;
 extern doom_boolean demorecording;
 
+// Tics played since the demo started.
+extern int demotic;
+
 // Quit after playing a demo from cmdline.
 extern doom_boolean singledemo;
 
+// The lump of the demo being played.
+extern char* defdemoname;
+
 //?
 extern gamestate_t gamestate;
 
@@ -4962,6 +5048,7 @@ doom_boolean P_GivePower(player_t*, int);
 #define SIL_TOP 2
 #define SIL_BOTH 3
 
+// Starting size, drawsegs grows as needed.
 #define MAXDRAWSEGS 256
 
 
@@ -5036,6 +5123,9 @@ typedef struct
 
     int linecount;
     struct line_s** lines;        // [linecount] size
+
+    // sightmoves when a plane last moved
+    int sightmoved;
 } sector_t;
 
 
@@ -5122,8 +5212,8 @@ typedef struct line_s
 typedef struct subsector_s
 {
     sector_t* sector;
-    short numlines;
-    short firstline;
+    int numlines;
+    int firstline;
 } subsector_t;
 
 
@@ -5165,7 +5255,7 @@ typedef struct
     fixed_t bbox[2][4];
 
     // If NF_SUBSECTOR its a subsector.
-    unsigned short children[2];
+    unsigned children[2];
 } node_t;
 
 
@@ -5911,11 +6001,11 @@ int EV_Teleport(line_t* line, int side, mobj_t* thing);
 //#include "r_defs.h"
 
 
-extern seg_t* curline;
+extern DOOM_THREADLOCAL seg_t* curline;
 extern side_t* sidedef;
 extern line_t* linedef;
-extern sector_t* frontsector;
-extern sector_t* backsector;
+extern DOOM_THREADLOCAL sector_t* frontsector;
+extern DOOM_THREADLOCAL sector_t* backsector;
 
 extern int rw_x;
 extern int rw_stopx;
@@ -5928,8 +6018,10 @@ extern doom_boolean markceiling;
 
 extern doom_boolean skymap;
 
-extern drawseg_t drawsegs[MAXDRAWSEGS];
+extern drawseg_t* drawsegs;
 extern drawseg_t* ds_p;
+extern int maxdrawsegs;
+extern int peakdrawsegs;
 
 extern lighttable_t** hscalelight;
 extern lighttable_t** vscalelight;
@@ -5955,15 +6047,15 @@ void R_RenderBSPNode(int bspnum);
 //#include "r_defs.h"
 
 
-extern lighttable_t* dc_colormap;
-extern int dc_x;
-extern int dc_yl;
-extern int dc_yh;
-extern fixed_t dc_iscale;
-extern fixed_t dc_texturemid;
+extern DOOM_THREADLOCAL lighttable_t* dc_colormap;
+extern DOOM_THREADLOCAL int dc_x;
+extern DOOM_THREADLOCAL int dc_yl;
+extern DOOM_THREADLOCAL int dc_yh;
+extern DOOM_THREADLOCAL fixed_t dc_iscale;
+extern DOOM_THREADLOCAL fixed_t dc_texturemid;
 
 // first pixel in a column
-extern byte* dc_source;
+extern DOOM_THREADLOCAL byte* dc_source;
 
 
 // The span blitting interface.
@@ -5984,22 +6076,22 @@ void R_DrawTranslatedColumnLow(void);
 
 void R_VideoErase(unsigned ofs, int count);
 
-extern int ds_y;
-extern int ds_x1;
-extern int ds_x2;
+extern DOOM_THREADLOCAL int ds_y;
+extern DOOM_THREADLOCAL int ds_x1;
+extern DOOM_THREADLOCAL int ds_x2;
 
-extern lighttable_t* ds_colormap;
+extern DOOM_THREADLOCAL lighttable_t* ds_colormap;
 
-extern fixed_t ds_xfrac;
-extern fixed_t ds_yfrac;
-extern fixed_t ds_xstep;
-extern fixed_t ds_ystep;
+extern DOOM_THREADLOCAL fixed_t ds_xfrac;
+extern DOOM_THREADLOCAL fixed_t ds_yfrac;
+extern DOOM_THREADLOCAL fixed_t ds_xstep;
+extern DOOM_THREADLOCAL fixed_t ds_ystep;
 
 // start of a 64*64 tile image
-extern byte* ds_source;
+extern DOOM_THREADLOCAL byte* ds_source;
 
 extern byte* translationtables;
-extern byte* dc_translation;
+extern DOOM_THREADLOCAL byte* dc_translation;
 
 
 // Span blitting for rows, floor/ceiling.
@@ -6009,6 +6101,20 @@ void R_DrawSpan(void);
 // Low resolution mode, 160x200?
 void R_DrawSpanLow(void);
 
+// Faster versions of R_DrawColumn and R_DrawSpan,
+//  which stay as the reference. Same pixels.
+void R_DrawColumnBatched(void);
+void R_DrawSpanBatched(void);
+#if defined(DOOM_AVX2)
+void R_DrawSpanAVX2(void);
+#endif
+
+// The high detail drawers, set by R_InitDrawers.
+extern void (*drawcolumnfunc) (void);
+extern void (*drawspanfunc) (void);
+
+void R_InitDrawers(void);
+
 void R_InitBuffer(int width, int height);
 
 
@@ -6152,6 +6258,33 @@ byte* R_GetColumn(int tex, int col);
 void R_InitData(void);
 void R_PrecacheLevel(void);
 
+// -asyncprecache: R_PrecacheLevel only queues the level's
+// graphics, and R_PrecacheStep loads them between frames.
+extern doom_boolean asyncprecache;
+
+// Set for lumps and textures still waiting in the queue.
+extern byte* precachelumps;
+extern byte* precachetextures;
+
+// Times the game needed something before the queue got to it.
+extern int precachestalls;
+
+// Called by D_Display, loads queued graphics for a while.
+void R_PrecacheStep(void);
+
+// Stops the loader and drops the queue. Called by P_SetupLevel,
+// whether or not the new level gets precached.
+void R_ClearPrecache(void);
+
+// -startcache <file>: texture column lookups and sprite
+// frames are kept in file, keyed by the WAD files loaded.
+// Sprite frames from the cache, or 0 (see R_InitSpriteDefs).
+extern byte* startcachesprites;
+
+// Called by R_InitSprites, writes the cache if it was
+// missing or out of date.
+void R_SaveStartupCache(void);
+
 // Retrieval.
 // Floor/ceiling opaque texture tiles,
 // lookup by name. For animation?
@@ -6235,15 +6368,31 @@ extern int detailshift;
 // Function pointers to switch refresh/drawing functions.
 // Used to select shadow mode etc.
 //
-extern void (*colfunc) (void);
+extern DOOM_THREADLOCAL void (*colfunc) (void);
 extern void (*basecolfunc) (void);
 extern void (*fuzzcolfunc) (void);
 // No shadow effects on floors.
 extern void (*spanfunc) (void);
 
 
+//
+// Strip refresh, see R_RenderPlayerView.
+// The columns this thread may draw into.
+//
+extern DOOM_THREADLOCAL int stripx1;
+extern DOOM_THREADLOCAL int stripx2;
+extern doom_boolean stripsactive;
+
+// Workers the refresh is split over, from -rthreads.
+// The pool may have more for other jobs.
+extern int refreshworkers;
+
+void R_DrawWallColumn(void);
+
+
 //
 // Utility functions.
+void* R_GrowArray(void* array, int* max, int size, int initial);
 int R_PointOnSide(fixed_t x, fixed_t y, node_t* node);
 int R_PointOnSegSide(fixed_t x, fixed_t y, seg_t* line);
 angle_t R_PointToAngle(fixed_t x, fixed_t y);
@@ -6278,7 +6427,9 @@ void R_SetViewSize(int blocks, int detail);
 
 
 // Visplane related.
+extern short* openings;
 extern short* lastopening;
+extern int peakopenings;
 
 typedef void (*planefunction_t) (int top, int bottom);
 
@@ -6288,14 +6439,29 @@ extern planefunction_t ceilingfunc_t;
 extern short floorclip[SCREENWIDTH];
 extern short ceilingclip[SCREENWIDTH];
 
+extern visplane_t* visplanes;
+extern visplane_t* lastvisplane;
+extern int peakvisplanes;
+
+extern DOOM_THREADLOCAL fixed_t cachedheight[SCREENHEIGHT];
+
+// Row parallel plane drawing, see R_DrawPlanes.
+extern doom_boolean planerows;
+extern doom_boolean planeslocked;
+extern DOOM_THREADLOCAL int planey1;
+extern DOOM_THREADLOCAL int planey2;
+
 extern fixed_t yslope[SCREENHEIGHT];
 extern fixed_t distscale[SCREENWIDTH];
 
 void R_InitPlanes(void);
 void R_ClearPlanes(void);
+void R_CheckOpenings(int count);
 void R_MapPlane(int y, int x1, int x2);
 void R_MakeSpans(int x, int t1, int b1, int t2, int b2);
 void R_DrawPlanes(void);
+void R_LockPlanes(void);
+void R_UnlockPlanes(void);
 visplane_t* R_FindPlane(fixed_t height, int picnum, int lightlevel);
 visplane_t* R_CheckPlane(visplane_t* pl, int start, int stop);
 
@@ -6310,11 +6476,13 @@ visplane_t* R_CheckPlane(visplane_t* pl, int start, int stop);
 //#include "r_defs.h"
 
 
+// Starting size, vissprites grows as needed.
 #define MAXVISSPRITES 128
 
 
-extern vissprite_t vissprites[MAXVISSPRITES];
+extern vissprite_t* vissprites;
 extern vissprite_t* vissprite_p;
+extern int peakvissprites;
 extern vissprite_t vsprsortedhead;
 
 // Constant arrays used for psprite clipping
@@ -6323,10 +6491,10 @@ extern short negonearray[SCREENWIDTH];
 extern short screenheightarray[SCREENWIDTH];
 
 // vars for R_DrawMaskedColumn
-extern short* mfloorclip;
-extern short* mceilingclip;
-extern fixed_t spryscale;
-extern fixed_t sprtopscreen;
+extern DOOM_THREADLOCAL short* mfloorclip;
+extern DOOM_THREADLOCAL short* mceilingclip;
+extern DOOM_THREADLOCAL fixed_t spryscale;
+extern DOOM_THREADLOCAL fixed_t sprtopscreen;
 
 extern fixed_t pspritescale;
 extern fixed_t pspriteiscale;
@@ -6418,11 +6586,57 @@ void R_DrawMasked(void);
 // both the head and tail of the thinker list
 extern thinker_t thinkercap;
 
+// the thinker list as an array, in list order
+extern thinker_t** runthinkers;
+extern int numrunthinkers;
+
 
 void P_InitThinkers(void);
 void P_AddThinker(thinker_t* thinker);
 void P_RemoveThinker(thinker_t* thinker);
 
+// Mobjs and specials come out of per type pools,
+// which go away with the rest of the level.
+typedef enum
+{
+    pool_mobj,
+    pool_ceiling,
+    pool_door,
+    pool_floor,
+    pool_plat,
+    pool_flicker,
+    pool_flash,
+    pool_strobe,
+    pool_glow,
+    NUMPOOLS
+} pooltype_t;
+
+typedef struct
+{
+    int size;       // of one object
+    void* free;     // freed objects, linked through their first word
+    byte* slab;     // unused end of the current slab
+    int slableft;
+    int slabs;      // up to and including the current one
+    byte* firstslab; // the rest are linked through their first word
+    byte* curslab;
+    int live;
+    int allocs;     // since the start of the tic
+    int frees;
+} pool_t;
+
+extern pool_t pools[NUMPOOLS];
+
+void P_InitPools(void);
+void* P_AllocThinker(pooltype_t type);
+void P_FreeThinker(thinker_t* thinker);
+void P_RelinkThinkers(void);
+
+// For P_ArchiveSnapshot.
+int P_PoolsSize(void);
+void P_ArchivePools(void);
+void P_UnArchivePools(void);
+
 
 //
 // P_PSPR
@@ -6495,9 +6709,12 @@ typedef struct
 } intercept_t;
 
 
+// Intercepts grow as needed, MAXINTERCEPTS is only
+//  the first size. Vanilla overran a fixed array here.
 #define MAXINTERCEPTS        128
-extern intercept_t intercepts[MAXINTERCEPTS];
+extern intercept_t* intercepts;
 extern intercept_t* intercept_p;
+extern int maxintercepts;
 
 
 typedef doom_boolean(*traverser_t) (intercept_t* in);
@@ -6522,6 +6739,7 @@ void P_LineOpening(line_t* linedef);
 
 doom_boolean P_BlockLinesIterator(int x, int y, doom_boolean(*func)(line_t*));
 doom_boolean P_BlockThingsIterator(int x, int y, doom_boolean(*func)(mobj_t*));
+doom_boolean P_BlockThingsNear(int x, int y, fixed_t px, fixed_t py, fixed_t reach, doom_boolean(*func)(mobj_t*));
 
 
 #define PT_ADDLINES     1
@@ -6556,6 +6774,24 @@ doom_boolean P_TeleportMove(mobj_t* thing, fixed_t x, fixed_t y);
 void P_SlideMove(mobj_t* mo);
 doom_boolean P_CheckSight(mobj_t* t1, mobj_t* t2);
 void P_UseLines(player_t* player);
+
+// P_CheckSight calls rejected by REJECT, walked
+// through the BSP, and answered by the sight cache,
+// which is only used with -sightbatch, then checks
+// made ahead by -sightbatch.
+extern int sightcounts[4];
+
+// Bumped by P_Ticker, which makes everything in the
+// sight cache stale.
+extern int sightepoch;
+
+// Bumped by T_MovePlane, which only makes the checks
+// that went through the moving sector stale.
+extern int sightmoves;
+
+// -sightbatch, see P_BatchSight.
+extern doom_boolean sightbatch;
+void P_BatchSight(void);
 doom_boolean P_ChangeSector(sector_t* sector, doom_boolean crunch);
 
 
@@ -6571,13 +6807,30 @@ void P_RadiusAttack(mobj_t* spot, mobj_t* source, int damage);
 // P_SETUP
 //
 extern byte* rejectmatrix; // for fast sight rejection
-extern short* blockmaplump; // offsets in blockmap are from here
-extern short* blockmap;
+extern int* blockmaplump; // offsets in blockmap are from here
+extern int* blockmap;
 extern int bmapwidth;
 extern int bmapheight; // in mapblocks
 extern fixed_t bmaporgx;
 extern fixed_t bmaporgy; // origin of block map
-extern mobj_t** blocklinks; // for thing chains
+
+// The things in a mapblock, oldest first, with the
+//  fields P_BlockThingsNear tests kept alongside so
+//  that far things are passed over without touching
+//  the mobj_t. Removed things are left as 0 while a
+//  block is being iterated, and squeezed out later.
+typedef struct
+{
+    int count;
+    int max;
+    int removed;
+    mobj_t** mobjs;
+    fixed_t* x;
+    fixed_t* y;
+    fixed_t* radius;
+} blockthings_t;
+
+extern blockthings_t* blockthings; // for thing chains
 
 
 //
@@ -6867,6 +7120,8 @@ typedef struct
     void* handle;
     int position;
     int size;
+    byte* data;     // in the mapped file, or 0
+    int next;       // earlier lump in the same hash chain, or -1
 } lumpinfo_t;
 
 
@@ -6874,6 +7129,23 @@ extern void** lumpcache;
 extern lumpinfo_t* lumpinfo;
 extern int numlumps;
 
+// -mmap: lumps are used straight out of the mapped
+// WAD files, instead of being copied into the zone.
+extern doom_boolean wadmapping;
+
+// True if ptr points into a mapped WAD file;
+// Z_Free and Z_ChangeTag leave those alone.
+doom_boolean W_IsMapped(void* ptr);
+
+// Maps a whole file, or returns 0. Also used for the
+// startup cache, see R_LoadStartupCache.
+byte* W_MapFile(char* filename, int* size);
+void W_UnmapFile(byte* base, int size);
+
+// Size and modification time of a file, without reading it.
+// Returns false if there is no such file.
+doom_boolean W_FileStamp(char* filename, long long* size, long long* mtime);
+
 void W_InitMultipleFiles(char** filenames);
 void W_Reload(void);
 
@@ -6947,7 +7219,19 @@ void  Z_CheckHeap(void);
 void  Z_ChangeTag2(void* ptr, int tag);
 int   Z_FreeMemory(void);
 
+// Called once before Z_Malloc throws out a purgable block,
+// so that anything still holding cached pointers can finish.
+extern void (*zonepurgefunc)(void);
+
+// Allocator counters, since startup.
+extern int zonemallocs;
+extern int zonefrees;
+extern int zonepurges;  // purgable blocks thrown out
+extern int zonescans;   // blocks looked at while finding room
 
+// Free blocks are kept in lists by size, so Z_Malloc
+// does not have to walk the zone to find room.
+// Define DOOM_CLASSIC_ZONE for the original rover first fit.
 typedef struct memblock_s
 {
     int size;       // including the header and possibly tiny fragments
@@ -6956,6 +7240,10 @@ typedef struct memblock_s
     int id;         // should be ZONEID
     struct memblock_s* next;
     struct memblock_s* prev;
+#if !defined(DOOM_CLASSIC_ZONE)
+    struct memblock_s* freenext;    // size class list, free blocks only
+    struct memblock_s* freeprev;
+#endif
 } memblock_t;
 
 //
@@ -6964,15 +7252,18 @@ typedef struct memblock_s
 //
 #define Z_ChangeTag(p,t) \
 { \
-    if (( (memblock_t *)( (byte *)(p) - sizeof(memblock_t)))->id!=0x1d4a11) \
+    if (!W_IsMapped(p)) \
     { \
-        /*I_Error("Error: Z_CT at "__FILE__":%i",__LINE__);*/ \
-        char buf[260]; \
-        doom_strcpy(buf, "Error: Z_CT at " __FILE__ ":"); \
-        doom_concat(buf, doom_itoa(__LINE__, 10)); \
-        I_Error(buf); \
+        if (( (memblock_t *)( (byte *)(p) - sizeof(memblock_t)))->id!=0x1d4a11) \
+        { \
+            /*I_Error("Error: Z_CT at "__FILE__":%i",__LINE__);*/ \
+            char buf[260]; \
+            doom_strcpy(buf, "Error: Z_CT at " __FILE__ ":"); \
+            doom_concat(buf, doom_itoa(__LINE__, 10)); \
+            I_Error(buf); \
+        } \
+        Z_ChangeTag2(p,t); \
     } \
-    Z_ChangeTag2(p,t); \
 };
 
 
@@ -7554,6 +7845,14 @@ void doom_update()
     int now = I_GetTime();
     int delta_time = now - last_update_time;
 
+    if (seektic >= 0)
+    {
+        // pick up at normal speed once it's done
+        D_RunSeek();
+        last_update_time = I_GetTime();
+        return;
+    }
+
     while (delta_time-- > 0)
     {
         if (is_wiping_screen)
@@ -7566,6 +7865,18 @@ void doom_update()
 }
 
 
+void doom_seek_demo(int tic)
+{
+    D_SeekDemo(tic);
+}
+
+
+int doom_is_seeking()
+{
+    return seektic >= 0;
+}
+
+
 void doom_force_update()
 {
     if (is_wiping_screen)
@@ -9298,6 +9609,10 @@ void D_Display(void)
     // draw buffered stuff to screen
     I_UpdateNoBlit();
 
+    // load a little more of the level, if that is still going on
+    if (gamestate == GS_LEVEL)
+        R_PrecacheStep();
+
     // draw the view directly
     if (gamestate == GS_LEVEL && !automapactive && gametic)
         R_RenderPlayerView(&players[displayplayer]);
@@ -9450,6 +9765,112 @@ void D_DoomLoop(void)
 }
 
 
+//
+// DEMO SEEK
+// D_RunSeek runs tics the way singletics does, less
+// the input, menu, sound and display, for SEEKUSEC at a
+// time so the host keeps polling, until the demo gets
+// to seektic or ends. Then it reports the tic rate.
+// D_SeekDemo first jumps to the nearest snapshot, if
+// that is closer, see G_TakeSnapshot.
+//
+#define SEEKUSEC 100000
+
+int seektic = -1;
+int seektics;
+int seekusec;
+
+
+//
+// D_SeekDemo
+//
+void D_SeekDemo(int tic)
+{
+    int snapshot;
+
+    if (gameaction != ga_playdemo)
+    {
+        // already there, or nothing to seek: this also
+        //  cancels a seek that is still running
+        if (!demoplayback || tic == demotic)
+        {
+            seektic = -1;
+            return;
+        }
+
+        snapshot = G_SnapshotTic(tic);
+        if (snapshot > demotic || (tic < demotic && snapshot >= 0))
+        {
+            G_RestoreSnapshot(tic);
+        }
+        else if (tic < demotic)
+        {
+            // nothing to go back to in this level
+            G_DeferedPlayDemo(defdemoname);
+        }
+    }
+
+    seektic = tic;
+    seektics = 0;
+    seekusec = 0;
+}
+
+
+//
+// D_RunSeek
+// Returns true while still seeking.
+//
+doom_boolean D_RunSeek(void)
+{
+    int sec;
+    int usec;
+    int startsec;
+    int startusec;
+    int elapsed;
+
+    doom_gettime(&startsec, &startusec);
+
+    do
+    {
+        if (gameaction != ga_playdemo
+            && (!demoplayback || demotic >= seektic))
+        {
+            break;
+        }
+
+        if (advancedemo)
+            D_DoAdvanceDemo();
+        G_Ticker();
+        gametic++;
+        maketic++;
+        seektics++;
+
+        doom_gettime(&sec, &usec);
+        elapsed = (sec - startsec) * 1000000 + usec - startusec;
+    } while (elapsed < SEEKUSEC);
+
+    doom_gettime(&sec, &usec);
+    seekusec += (sec - startsec) * 1000000 + usec - startusec;
+
+    if (gameaction == ga_playdemo || (demoplayback && demotic < seektic))
+        return true;
+
+    //doom_print("D_RunSeek: tic %i, %i tics in %i ms, %i tics/sec\n", ...);
+    doom_print("D_RunSeek: tic ");
+    doom_print(doom_itoa(demotic, 10));
+    doom_print(", ");
+    doom_print(doom_itoa(seektics, 10));
+    doom_print(" tics in ");
+    doom_print(doom_itoa(seekusec / 1000, 10));
+    doom_print(" ms, ");
+    doom_print(doom_itoa(seekusec ? (int)((long long)seektics * 1000000 / seekusec) : 0, 10));
+    doom_print(" tics/sec\n");
+
+    seektic = -1;
+    return false;
+}
+
+
 //
 //  DEMO LOOP
 //
@@ -10253,11 +10674,21 @@ void D_DoomMain(void)
         autostart = true;
     }
 
+    // seconds between demo snapshots, 0 for none
+    p = M_CheckParm("-snapshots");
+    if (p && p < myargc - 1)
+        snapshotinterval = doom_atoi(myargv[p + 1]) * TICRATE;
+
     p = M_CheckParm("-playdemo");
     if (p && p < myargc - 1)
     {
         singledemo = true;              // quit after one demo
         G_DeferedPlayDemo(myargv[p + 1]);
+
+        p = M_CheckParm("-seektic");
+        if (p && p < myargc - 1)
+            D_SeekDemo(doom_atoi(myargv[p + 1]));
+
         D_DoomLoop();  // never returns
     }
 
@@ -12089,6 +12520,8 @@ void G_DoPlayDemo(void);
 void G_DoCompleted(void);
 void G_DoWorldDone(void);
 void G_DoSaveGame(void);
+void G_TakeSnapshot(void);
+void G_ClearSnapshots(void);
 void P_SpawnPlayer(mapthing_t* mthing);
 void R_ExecuteSetViewSize(void);
 
@@ -12126,6 +12559,7 @@ int totalkills, totalitems, totalsecret; // for intermission
 char demoname[32];
 doom_boolean demorecording;
 doom_boolean demoplayback;
+int demotic;
 doom_boolean netdemo;
 byte* demobuffer;
 byte* demo_p;
@@ -12465,6 +12899,9 @@ void G_DoLoadLevel(void)
 {
     int i;
 
+    // they only go back into the level they came from
+    G_ClearSnapshots();
+
     // Set the sky map.
     // First thing, we have a dummy sky texture name,
     //  a flat. The data is in the WAD only because
@@ -12722,6 +13159,9 @@ void G_Ticker(void)
         }
     }
 
+    if (demoplayback)
+        demotic++;
+
     // check for special buttons
     for (i = 0; i < MAXPLAYERS; i++)
     {
@@ -12773,6 +13213,14 @@ void G_Ticker(void)
             D_PageTicker();
             break;
     }
+
+    // something to seek back to
+    if (demoplayback && !timingdemo && snapshotinterval
+        && gamestate == GS_LEVEL && gameaction == ga_nothing
+        && !(demotic % snapshotinterval))
+    {
+        G_TakeSnapshot();
+    }
 }
 
 
@@ -13610,6 +14058,7 @@ void G_DoPlayDemo(void)
 
     usergame = false;
     demoplayback = true;
+    demotic = 0;
 }
 
 //
@@ -13627,6 +14076,364 @@ void G_TimeDemo(char* name)
 }
 
 
+//
+// SNAPSHOTS
+// While a demo plays, the level is snapshotted every
+//  snapshotinterval tics into a ring of SNAPSHOTS, so
+//  a seek restores the nearest one before the tic and
+//  only runs forward from there. Most of them are kept
+//  as the bytes that changed since the one before,
+//  with a whole one every SNAPSHOTKEY. The ring is
+//  emptied when a level is loaded.
+//
+#define SNAPSHOTS 32
+#define SNAPSHOTKEY 8
+#define SNAPSHOTRUN 8 // unchanged bytes that end a run of changed ones
+
+typedef struct
+{
+    int tic;
+    doom_boolean key;   // whole, rather than a delta
+    int length;         // whole
+    int size;           // of data
+    byte* data;
+} snapshot_t;
+
+snapshot_t snapshots[SNAPSHOTS];
+int firstsnapshot;
+int numsnapshots;
+int snapshotinterval = 10 * TICRATE;
+
+// The newest snapshot whole, for the next delta,
+//  and room to take, encode and decode them in.
+byte* snapshotlast;
+int snapshotlastlength;
+int snapshotlastmax;
+byte* snapshotwork;
+int snapshotworkmax;
+byte* snapshotdelta;
+int snapshotdeltamax;
+
+
+//
+// G_SnapshotBuffer
+// Makes buffer at least size bytes.
+// What was in it is lost when it grows.
+//
+byte* G_SnapshotBuffer(byte* buffer, int* max, int size)
+{
+    if (size <= *max)
+        return buffer;
+
+    if (buffer)
+        doom_free(buffer);
+
+    *max = size + size / 4;
+    return doom_malloc(*max);
+}
+
+
+//
+// G_EncodeSnapshot
+// A delta is a series of runs: an int count of bytes
+//  that are the same as in prev, an int count of ones
+//  that aren't, and those bytes.
+// Writes at most 2 * length + 8 bytes.
+//
+int G_EncodeSnapshot(byte* delta, byte* data, int length,
+                     byte* prev, int prevlength)
+{
+    byte* put;
+    int common;
+    int start;
+    int same;
+    int count;
+    int i;
+    int j;
+
+    put = delta;
+    common = prevlength < length ? prevlength : length;
+    i = 0;
+
+    while (i < length)
+    {
+        start = i;
+        while (i < common && data[i] == prev[i])
+            i++;
+        same = i - start;
+
+        // up to the next SNAPSHOTRUN unchanged bytes
+        start = i;
+        while (i < length)
+        {
+            for (j = 0; j < SNAPSHOTRUN && i + j < common; j++)
+                if (data[i + j] != prev[i + j])
+                    break;
+
+            if (j == SNAPSHOTRUN)
+                break;
+            i++;
+        }
+        count = i - start;
+
+        doom_memcpy(put, &same, sizeof(same));
+        put += sizeof(same);
+        doom_memcpy(put, &count, sizeof(count));
+        put += sizeof(count);
+        doom_memcpy(put, data + start, count);
+        put += count;
+    }
+
+    return (int)(put - delta);
+}
+
+
+//
+// G_DecodeSnapshot
+// In place, over the whole snapshot before it.
+//
+void G_DecodeSnapshot(byte* data, snapshot_t* snapshot)
+{
+    byte* get;
+    byte* end;
+    int same;
+    int count;
+    int i;
+
+    get = snapshot->data;
+    end = get + snapshot->size;
+    i = 0;
+
+    while (get < end)
+    {
+        doom_memcpy(&same, get, sizeof(same));
+        get += sizeof(same);
+        doom_memcpy(&count, get, sizeof(count));
+        get += sizeof(count);
+
+        i += same;
+        doom_memcpy(data + i, get, count);
+        get += count;
+        i += count;
+    }
+}
+
+
+//
+// G_ExpandSnapshot
+// Decodes the n'th oldest snapshot into snapshotwork,
+//  from the whole one before it. The oldest is always
+//  whole. Returns its length.
+//
+int G_ExpandSnapshot(int n)
+{
+    snapshot_t* snapshot;
+    int key;
+    int max;
+    int i;
+
+    max = 0;
+    for (key = n; ; key--)
+    {
+        snapshot = &snapshots[(firstsnapshot + key) % SNAPSHOTS];
+        if (snapshot->length > max)
+            max = snapshot->length;
+        if (snapshot->key)
+            break;
+    }
+
+    snapshotwork = G_SnapshotBuffer(snapshotwork, &snapshotworkmax, max);
+    doom_memcpy(snapshotwork, snapshot->data, snapshot->length);
+
+    for (i = key + 1; i <= n; i++)
+        G_DecodeSnapshot(snapshotwork, &snapshots[(firstsnapshot + i) % SNAPSHOTS]);
+
+    return snapshots[(firstsnapshot + n) % SNAPSHOTS].length;
+}
+
+
+//
+// G_DropSnapshot
+// Makes room in a full ring. If the one after
+//  the oldest is a delta, it's made whole first.
+//
+void G_DropSnapshot(void)
+{
+    snapshot_t* next;
+    int length;
+
+    next = &snapshots[(firstsnapshot + 1) % SNAPSHOTS];
+    if (!next->key)
+    {
+        length = G_ExpandSnapshot(1);
+        doom_free(next->data);
+        next->data = doom_malloc(length);
+        doom_memcpy(next->data, snapshotwork, length);
+        next->size = length;
+        next->key = true;
+    }
+
+    doom_free(snapshots[firstsnapshot].data);
+    snapshots[firstsnapshot].data = 0;
+    firstsnapshot = (firstsnapshot + 1) % SNAPSHOTS;
+    numsnapshots--;
+}
+
+
+//
+// G_ClearSnapshots
+//
+void G_ClearSnapshots(void)
+{
+    int i;
+
+    for (i = 0; i < numsnapshots; i++)
+    {
+        doom_free(snapshots[(firstsnapshot + i) % SNAPSHOTS].data);
+        snapshots[(firstsnapshot + i) % SNAPSHOTS].data = 0;
+    }
+
+    firstsnapshot = 0;
+    numsnapshots = 0;
+}
+
+
+//
+// G_TakeSnapshot
+// Called by G_Ticker. Seeking back and playing on
+//  comes by the same tics again, which are skipped.
+//
+void G_TakeSnapshot(void)
+{
+    snapshot_t* snapshot;
+    byte* buffer;
+    int length;
+    int i;
+
+    if (numsnapshots
+        && snapshots[(firstsnapshot + numsnapshots - 1) % SNAPSHOTS].tic >= demotic)
+    {
+        return;
+    }
+
+    if (numsnapshots == SNAPSHOTS)
+        G_DropSnapshot();
+
+    snapshotwork = G_SnapshotBuffer(snapshotwork, &snapshotworkmax, P_SnapshotSize());
+    save_p = snapshotwork;
+    P_ArchiveSnapshot();
+    length = (int)(save_p - snapshotwork);
+
+    for (i = numsnapshots - 1; i >= 0; i--)
+        if (snapshots[(firstsnapshot + i) % SNAPSHOTS].key)
+            break;
+
+    snapshot = &snapshots[(firstsnapshot + numsnapshots) % SNAPSHOTS];
+    snapshot->tic = demotic;
+    snapshot->key = i < 0 || numsnapshots - i >= SNAPSHOTKEY;
+    snapshot->length = length;
+
+    if (snapshot->key)
+    {
+        buffer = snapshotwork;
+        snapshot->size = length;
+    }
+    else
+    {
+        snapshotdelta = G_SnapshotBuffer(snapshotdelta, &snapshotdeltamax, 2 * length + 8);
+        buffer = snapshotdelta;
+        snapshot->size = G_EncodeSnapshot(snapshotdelta, snapshotwork, length,
+                                          snapshotlast, snapshotlastlength);
+    }
+
+    snapshot->data = doom_malloc(snapshot->size);
+    doom_memcpy(snapshot->data, buffer, snapshot->size);
+    numsnapshots++;
+
+    // keep it whole for the next one
+    buffer = snapshotlast;
+    snapshotlast = snapshotwork;
+    snapshotwork = buffer;
+    i = snapshotlastmax;
+    snapshotlastmax = snapshotworkmax;
+    snapshotworkmax = i;
+    snapshotlastlength = length;
+}
+
+
+//
+// G_FindSnapshot
+// The newest snapshot at or before tic, counted from
+//  the oldest, or -1.
+//
+int G_FindSnapshot(int tic)
+{
+    int n;
+
+    for (n = numsnapshots - 1; n >= 0; n--)
+        if (snapshots[(firstsnapshot + n) % SNAPSHOTS].tic <= tic)
+            break;
+
+    return n;
+}
+
+
+//
+// G_SnapshotTic
+// The tic of the one G_RestoreSnapshot would restore, or -1.
+//
+int G_SnapshotTic(int tic)
+{
+    int n;
+
+    n = G_FindSnapshot(tic);
+    return n < 0 ? -1 : snapshots[(firstsnapshot + n) % SNAPSHOTS].tic;
+}
+
+
+//
+// G_RestoreSnapshot
+// Puts the demo back, or forward, to the newest
+//  snapshot at or before tic.
+// Returns false if there isn't one.
+//
+doom_boolean G_RestoreSnapshot(int tic)
+{
+    int n;
+    int sec;
+    int usec;
+    int startsec;
+    int startusec;
+
+    n = G_FindSnapshot(tic);
+    if (n < 0)
+        return false;
+
+    doom_gettime(&startsec, &startusec);
+
+    G_ExpandSnapshot(n);
+    save_p = snapshotwork;
+    P_UnArchiveSnapshot();
+
+    // it may have gone on to the intermission
+    gamestate = GS_LEVEL;
+    gameaction = ga_nothing;
+    viewactive = true;
+    S_Start();
+
+    doom_gettime(&sec, &usec);
+
+    //doom_print("G_RestoreSnapshot: tic %i in %i ms\n", ...);
+    doom_print("G_RestoreSnapshot: tic ");
+    doom_print(doom_itoa(demotic, 10));
+    doom_print(" in ");
+    doom_print(doom_itoa(((sec - startsec) * 1000000 + usec - startusec) / 1000, 10));
+    doom_print(" ms\n");
+
+    return true;
+}
+
+
 /*
 ===================
 =
@@ -15184,6 +15991,21 @@ static int musicdies = -1;
 // The actual lengths of all sound effects.
 int lengths[NUMSFX];
 
+// Sound effects are loaded by I_StartSound the first time
+//  they are played. Once they take up more than sfxcachemax
+//  bytes, the least recently played ones are dropped again.
+#define SFXCACHEMAX (2 * 1024 * 1024)
+
+int sfxcachemax = SFXCACHEMAX;
+int sfxcachesize;
+int sfxlastused[NUMSFX];
+int sfxusecount;
+
+// Reported by I_ShutdownSound.
+int sfxloads;
+int sfxevictions;
+int sfxloadusec;
+
 // The actual output device.
 int audio_fd;
 
@@ -15768,6 +16590,116 @@ int I_GetSfxLumpNum(sfxinfo_t* sfx)
 }
 
 
+//
+// I_SfxPlaying
+// True if a channel is still reading the sound's data.
+//
+doom_boolean I_SfxPlaying(int id)
+{
+    unsigned char* data;
+    int i;
+
+    data = S_sfx[id].data;
+
+    for (i = 0; i < NUM_CHANNELS; i++)
+    {
+        if (channels[i] >= data && channels[i] <= data + lengths[id])
+            return true;
+    }
+
+    return false;
+}
+
+
+//
+// I_TrimSfxCache
+// Drops the least recently played sounds, other than keep,
+//  until the cache fits in sfxcachemax again.
+//
+void I_TrimSfxCache(int keep)
+{
+    int i;
+    int victim;
+
+    while (sfxcachesize > sfxcachemax)
+    {
+        victim = -1;
+
+        for (i = 1; i < NUMSFX; i++)
+        {
+            if (S_sfx[i].link
+                || !S_sfx[i].data
+                || i == keep
+                || I_SfxPlaying(i))
+            {
+                continue;
+            }
+
+            if (victim == -1 || sfxlastused[i] < sfxlastused[victim])
+                victim = i;
+        }
+
+        if (victim == -1)
+            break;
+
+        Z_Free((unsigned char*)S_sfx[victim].data - 8);
+        sfxcachesize -= lengths[victim] + 8;
+        S_sfx[victim].data = 0;
+        sfxevictions++;
+
+        // aliases share the data
+        for (i = 1; i < NUMSFX; i++)
+        {
+            if (S_sfx[i].link == &S_sfx[victim])
+                S_sfx[i].data = 0;
+        }
+    }
+}
+
+
+//
+// I_CacheSfx
+// Loads a sound effect, or its alias, if it isn't already.
+//
+void I_CacheSfx(int id)
+{
+    sfxinfo_t* sfx;
+    int owner;
+    int sec;
+    int usec;
+    int startsec;
+    int startusec;
+
+    sfx = &S_sfx[id];
+
+    // Alias? Example is the chaingun sound linked to pistol.
+    owner = sfx->link ? (int)(sfx->link - S_sfx) : id;
+
+    if (!S_sfx[owner].data)
+    {
+        doom_gettime(&startsec, &startusec);
+
+        // Load data from WAD file.
+        S_sfx[owner].data = getsfx(S_sfx[owner].name, &lengths[owner]);
+        sfxcachesize += lengths[owner] + 8;
+
+        doom_gettime(&sec, &usec);
+        sfxloadusec += (sec - startsec) * 1000000 + usec - startusec;
+        sfxloads++;
+
+        I_TrimSfxCache(owner);
+    }
+
+    sfxlastused[owner] = ++sfxusecount;
+
+    if (sfx->link)
+    {
+        sfx->data = S_sfx[owner].data;
+        lengths[id] = lengths[(sfx->link - S_sfx) / sizeof(sfxinfo_t)];
+    }
+}
+
+
 //
 // Starting a sound means adding it
 //  to the current list of active sounds
@@ -15782,6 +16714,8 @@ int I_GetSfxLumpNum(sfxinfo_t* sfx)
 //
 int I_StartSound(int id, int vol, int sep, int pitch, int priority)
 {
+    I_CacheSfx(id);
+
     // Returns a handle (not used).
     id = addsfx(id, vol, steptable[pitch], sep);
     return id;
@@ -15956,6 +16890,16 @@ void I_ShutdownSound(void)
     // FIXME (below).
     doom_print("I_ShutdownSound: NOT finishing pending sounds\n");
 
+    //doom_print("I_ShutdownSound: %i sounds loaded in %i ms, %i dropped\n",
+    //           sfxloads, sfxloadusec / 1000, sfxevictions);
+    doom_print("I_ShutdownSound: ");
+    doom_print(doom_itoa(sfxloads, 10));
+    doom_print(" sounds loaded in ");
+    doom_print(doom_itoa(sfxloadusec / 1000, 10));
+    doom_print(" ms, ");
+    doom_print(doom_itoa(sfxevictions, 10));
+    doom_print(" dropped\n");
+
     while (!done)
     {
         for (i = 0; i < 8 && !channels[i]; i++);
@@ -15977,26 +16921,14 @@ void I_InitSound()
     // Secure and configure sound device first.
     doom_print("I_InitSound: ");
 
-    // Initialize external data (all sounds) at start, keep static.
+    // Sounds are loaded as they are played, see I_CacheSfx.
     doom_print("I_InitSound: ");
 
-    for (i = 1; i < NUMSFX; i++)
-    {
-        // Alias? Example is the chaingun sound linked to pistol.
-        if (!S_sfx[i].link)
-        {
-            // Load data from WAD file.
-            S_sfx[i].data = getsfx(S_sfx[i].name, &lengths[i]);
-        }
-        else
-        {
-            // Previously loaded already?
-            S_sfx[i].data = S_sfx[i].link->data;
-            lengths[i] = lengths[(S_sfx[i].link - S_sfx) / sizeof(sfxinfo_t)];
-        }
-    }
+    i = M_CheckParm("-sfxcache");
+    if (i && i < myargc - 1)
+        sfxcachemax = doom_atoi(myargv[i + 1]) * 1024;
 
-    doom_print(" pre-cached all sound data\n");
+    doom_print(" sound data is loaded on first use\n");
 
     // Now initialize mixbuffer with zero.
     for (i = 0; i < MIXBUFFERSIZE; i++)
@@ -16365,6 +17297,207 @@ void I_Error(char* error)
 
     doom_exit(-1);
 }
+
+
+//
+// WORKER THREADS
+// Each worker waits for the job generation to change,
+//  runs its share of the job, and reports back.
+//
+#include <stdint.h>
+#if defined(DOOM_WIN32)
+#include <windows.h>
+static CRITICAL_SECTION worker_lock;
+static CONDITION_VARIABLE worker_start;
+static CONDITION_VARIABLE worker_done;
+#define I_LockWorkers() EnterCriticalSection(&worker_lock)
+#define I_UnlockWorkers() LeaveCriticalSection(&worker_lock)
+#define I_WaitWorkers(cond) SleepConditionVariableCS(&cond, &worker_lock, INFINITE)
+#define I_WakeWorkers(cond) WakeAllConditionVariable(&cond)
+#else
+#include <pthread.h>
+static pthread_mutex_t worker_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t worker_start = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t worker_done = PTHREAD_COND_INITIALIZER;
+#define I_LockWorkers() pthread_mutex_lock(&worker_lock)
+#define I_UnlockWorkers() pthread_mutex_unlock(&worker_lock)
+#define I_WaitWorkers(cond) pthread_cond_wait(&cond, &worker_lock)
+#define I_WakeWorkers(cond) pthread_cond_broadcast(&cond)
+#endif
+
+int numworkers = 1;
+
+static void (*worker_job)(int worker);
+static int worker_generation;
+static int worker_pending;
+
+
+static void I_WorkerLoop(int worker)
+{
+    int generation = 0;
+    void (*job)(int worker);
+
+    while (1)
+    {
+        I_LockWorkers();
+        while (worker_generation == generation)
+            I_WaitWorkers(worker_start);
+        generation = worker_generation;
+        job = worker_job;
+        I_UnlockWorkers();
+
+        job(worker);
+
+        I_LockWorkers();
+        if (--worker_pending == 0)
+            I_WakeWorkers(worker_done);
+        I_UnlockWorkers();
+    }
+}
+
+
+#if defined(DOOM_WIN32)
+static DWORD WINAPI I_WorkerThread(LPVOID param)
+{
+    I_WorkerLoop((int)(intptr_t)param);
+    return 0;
+}
+#else
+static void* I_WorkerThread(void* param)
+{
+    I_WorkerLoop((int)(intptr_t)param);
+    return 0;
+}
+#endif
+
+
+//
+// I_InitWorkers
+//
+void I_InitWorkers(int count)
+{
+    int i;
+
+    if (count > MAXWORKERS)
+        count = MAXWORKERS;
+
+#if defined(DOOM_WIN32)
+    // only once, as a second caller may find workers waiting on them
+    if (numworkers == 1)
+    {
+        InitializeCriticalSection(&worker_lock);
+        InitializeConditionVariable(&worker_start);
+        InitializeConditionVariable(&worker_done);
+    }
+#endif
+
+    for (i = numworkers; i < count; i++)
+    {
+#if defined(DOOM_WIN32)
+        if (!CreateThread(0, 0, I_WorkerThread, (LPVOID)(intptr_t)i, 0, 0))
+            break;
+#else
+        pthread_t thread;
+        if (pthread_create(&thread, 0, I_WorkerThread, (void*)(intptr_t)i))
+            break;
+        pthread_detach(thread);
+#endif
+        numworkers++;
+    }
+}
+
+
+//
+// I_RunWorkers
+//
+void I_RunWorkers(void (*job)(int worker))
+{
+    if (numworkers > 1)
+    {
+        I_LockWorkers();
+        worker_job = job;
+        worker_pending = numworkers - 1;
+        worker_generation++;
+        I_WakeWorkers(worker_start);
+        I_UnlockWorkers();
+    }
+
+    job(0);
+
+    if (numworkers > 1)
+    {
+        I_LockWorkers();
+        while (worker_pending)
+            I_WaitWorkers(worker_done);
+        I_UnlockWorkers();
+    }
+}
+
+
+//
+// LOADER THREAD
+// One thread per job, joined by I_WaitLoader.
+//
+static void (*loader_job)(void);
+static doom_boolean loader_running;
+
+#if defined(DOOM_WIN32)
+static HANDLE loader_thread;
+
+static DWORD WINAPI I_LoaderThread(LPVOID param)
+{
+    loader_job();
+    return 0;
+}
+#else
+static pthread_t loader_thread;
+
+static void* I_LoaderThread(void* param)
+{
+    loader_job();
+    return 0;
+}
+#endif
+
+
+//
+// I_StartLoader
+//
+void I_StartLoader(void (*job)(void))
+{
+    I_WaitLoader();
+
+    loader_job = job;
+
+#if defined(DOOM_WIN32)
+    loader_thread = CreateThread(0, 0, I_LoaderThread, 0, 0, 0);
+    loader_running = loader_thread != 0;
+#else
+    loader_running = !pthread_create(&loader_thread, 0, I_LoaderThread, 0);
+#endif
+
+    if (!loader_running)
+        job();
+}
+
+
+//
+// I_WaitLoader
+//
+void I_WaitLoader(void)
+{
+    if (!loader_running)
+        return;
+
+#if defined(DOOM_WIN32)
+    WaitForSingleObject(loader_thread, INFINITE);
+    CloseHandle(loader_thread);
+#else
+    pthread_join(loader_thread, 0);
+#endif
+
+    loader_running = false;
+}
 #define POINTER_WARP_COUNTDOWN 1
 
 
@@ -24165,7 +25298,7 @@ int EV_DoCeiling(line_t* line, ceiling_e type)
 
         // new door thinker
         rtn = 1;
-        ceiling = Z_Malloc(sizeof(*ceiling), PU_LEVSPEC, 0);
+        ceiling = P_AllocThinker(pool_ceiling);
         P_AddThinker(&ceiling->thinker);
         sec->specialdata = ceiling;
         ceiling->thinker.function.acp1 = (actionf_p1)T_MoveCeiling;
@@ -24508,7 +25641,7 @@ int EV_DoDoor(line_t* line, vldoor_e type)
 
         // new door thinker
         rtn = 1;
-        door = Z_Malloc(sizeof(*door), PU_LEVSPEC, 0);
+        door = P_AllocThinker(pool_door);
         P_AddThinker(&door->thinker);
         sec->specialdata = door;
 
@@ -24680,7 +25813,7 @@ void EV_VerticalDoor(line_t* line, mobj_t* thing)
 
 
     // new door thinker
-    door = Z_Malloc(sizeof(*door), PU_LEVSPEC, 0);
+    door = P_AllocThinker(pool_door);
     P_AddThinker(&door->thinker);
     sec->specialdata = door;
     door->thinker.function.acp1 = (actionf_p1)T_VerticalDoor;
@@ -24730,7 +25863,7 @@ void P_SpawnDoorCloseIn30(sector_t* sec)
 {
     vldoor_t* door;
 
-    door = Z_Malloc(sizeof(*door), PU_LEVSPEC, 0);
+    door = P_AllocThinker(pool_door);
 
     P_AddThinker(&door->thinker);
 
@@ -24753,7 +25886,7 @@ void P_SpawnDoorRaiseIn5Mins(sector_t* sec, int secnum)
 {
     vldoor_t* door;
 
-    door = Z_Malloc(sizeof(*door), PU_LEVSPEC, 0);
+    door = P_AllocThinker(pool_door);
 
     P_AddThinker(&door->thinker);
 
@@ -24815,6 +25948,7 @@ fixed_t viletryy;
 mobj_t* braintargets[32];
 int numbraintargets;
 int braintargeton;
+int braineasy; // every other spit is skipped on easy
 
 
 extern line_t* spechit[MAXSPECIALCROSS];
@@ -26586,10 +27720,8 @@ void A_BrainSpit(mobj_t* mo)
     mobj_t* targ;
     mobj_t* newmobj;
 
-    static int easy = 0;
-
-    easy ^= 1;
-    if (gameskill <= sk_easy && (!easy))
+    braineasy ^= 1;
+    if (gameskill <= sk_easy && (!braineasy))
         return;
 
     // shoot a cube at current target
@@ -26696,6 +27828,9 @@ result_e T_MovePlane(sector_t* sector,
     doom_boolean flag;
     fixed_t lastpos;
 
+    // sight lines through this sector may change
+    sector->sightmoved = ++sightmoves;
+
     switch (floorOrCeiling)
     {
         case 0:
@@ -26915,7 +28050,7 @@ int EV_DoFloor(line_t* line, floor_e floortype)
 
         // new floor thinker
         rtn = 1;
-        floor = Z_Malloc(sizeof(*floor), PU_LEVSPEC, 0);
+        floor = P_AllocThinker(pool_floor);
         P_AddThinker(&floor->thinker);
         sec->specialdata = floor;
         floor->thinker.function.acp1 = (actionf_p1)T_MoveFloor;
@@ -27114,7 +28249,7 @@ int EV_BuildStairs(line_t* line, stair_e type)
 
         // new floor thinker
         rtn = 1;
-        floor = Z_Malloc(sizeof(*floor), PU_LEVSPEC, 0);
+        floor = P_AllocThinker(pool_floor);
         P_AddThinker(&floor->thinker);
         sec->specialdata = floor;
         floor->thinker.function.acp1 = (actionf_p1)T_MoveFloor;
@@ -27167,7 +28302,7 @@ int EV_BuildStairs(line_t* line, stair_e type)
 
                 sec = tsec;
                 secnum = newsecnum;
-                floor = Z_Malloc(sizeof(*floor), PU_LEVSPEC, 0);
+                floor = P_AllocThinker(pool_floor);
 
                 P_AddThinker(&floor->thinker);
 
@@ -28094,7 +29229,7 @@ void P_SpawnFireFlicker(sector_t* sector)
     // Nothing special about it during gameplay.
     sector->special = 0;
 
-    flick = Z_Malloc(sizeof(*flick), PU_LEVSPEC, 0);
+    flick = P_AllocThinker(pool_flicker);
 
     P_AddThinker(&flick->thinker);
 
@@ -28144,7 +29279,7 @@ void P_SpawnLightFlash(sector_t* sector)
     // nothing special about it during gameplay
     sector->special = 0;
 
-    flash = Z_Malloc(sizeof(*flash), PU_LEVSPEC, 0);
+    flash = P_AllocThinker(pool_flash);
 
     P_AddThinker(&flash->thinker);
 
@@ -28193,7 +29328,7 @@ void P_SpawnStrobeFlash(sector_t* sector, int fastOrSlow, int inSync)
 {
     strobe_t* flash;
 
-    flash = Z_Malloc(sizeof(*flash), PU_LEVSPEC, 0);
+    flash = P_AllocThinker(pool_strobe);
 
     P_AddThinker(&flash->thinker);
 
@@ -28345,7 +29480,7 @@ void P_SpawnGlowingLight(sector_t* sector)
 {
     glow_t* g;
 
-    g = Z_Malloc(sizeof(*g), PU_LEVSPEC, 0);
+    g = P_AllocThinker(pool_glow);
 
     P_AddThinker(&g->thinker);
 
@@ -28401,8 +29536,8 @@ doom_boolean nofit;
 
 
 // slopes to top and bottom of target
-extern fixed_t topslope;
-extern fixed_t bottomslope;
+extern DOOM_THREADLOCAL fixed_t topslope;
+extern DOOM_THREADLOCAL fixed_t bottomslope;
 
 
 //
@@ -28489,7 +29624,7 @@ doom_boolean P_TeleportMove(mobj_t* thing, fixed_t x, fixed_t y)
 
     for (bx = xl; bx <= xh; bx++)
         for (by = yl; by <= yh; by++)
-            if (!P_BlockThingsIterator(bx, by, PIT_StompThing))
+            if (!P_BlockThingsNear(bx, by, tmx, tmy, tmthing->radius, PIT_StompThing))
                 return false;
 
     // the move is ok,
@@ -28750,7 +29885,7 @@ doom_boolean P_CheckPosition(mobj_t* thing, fixed_t x, fixed_t y)
 
     for (bx = xl; bx <= xh; bx++)
         for (by = yl; by <= yh; by++)
-            if (!P_BlockThingsIterator(bx, by, PIT_CheckThing))
+            if (!P_BlockThingsNear(bx, by, tmx, tmy, tmthing->radius, PIT_CheckThing))
                 return false;
 
     // check lines
@@ -29510,7 +30645,7 @@ void P_RadiusAttack(mobj_t* spot, mobj_t* source, int damage)
 
     for (y = yl; y <= yh; y++)
         for (x = xl; x <= xh; x++)
-            P_BlockThingsIterator(x, y, PIT_RadiusAttack);
+            P_BlockThingsNear(x, y, spot->x, spot->y, damage << FRACBITS, PIT_RadiusAttack);
 }
 
 
@@ -29612,8 +30747,9 @@ fixed_t opentop;
 fixed_t openbottom;
 fixed_t openrange;
 fixed_t lowfloor;
-intercept_t intercepts[MAXINTERCEPTS];
+intercept_t* intercepts;
 intercept_t* intercept_p;
+int maxintercepts;
 divline_t trace;
 doom_boolean earlyout;
 int ptflags;
@@ -29852,6 +30988,124 @@ void P_LineOpening(line_t* linedef)
 // THING POSITION SETTING
 //
 
+//
+// BLOCK THINGS
+// A block's things are kept in the order they were
+// linked, and walked newest first, which is the order
+// the old bnext chains had. Things linked during a
+// walk land past the end and aren't seen by it.
+//
+
+// Nonzero while a block thing iterator is running,
+//  so removed entries must keep their place.
+int blockwalking;
+
+
+//
+// P_CompactBlockThings
+// Squeezes out the removed entries of a block.
+//
+void P_CompactBlockThings(blockthings_t* block)
+{
+    int i;
+    int count;
+
+    count = 0;
+    for (i = 0; i < block->count; i++)
+    {
+        if (!block->mobjs[i])
+            continue;
+
+        block->mobjs[count] = block->mobjs[i];
+        block->x[count] = block->x[i];
+        block->y[count] = block->y[i];
+        block->radius[count] = block->radius[i];
+        count++;
+    }
+
+    block->count = count;
+    block->removed = 0;
+}
+
+
+//
+// P_LinkBlockThing
+//
+void P_LinkBlockThing(blockthings_t* block, mobj_t* thing)
+{
+    blockthings_t grown;
+    int max;
+    int n;
+
+    if (block->removed && !blockwalking)
+        P_CompactBlockThings(block);
+
+    if (block->count == block->max)
+    {
+        max = block->max ? block->max * 2 : 4;
+        grown.mobjs = Z_Malloc(max * (sizeof(mobj_t*) + 3 * sizeof(fixed_t)), PU_LEVEL, 0);
+        grown.x = (fixed_t*)(grown.mobjs + max);
+        grown.y = grown.x + max;
+        grown.radius = grown.y + max;
+
+        n = block->count;
+        if (n)
+        {
+            doom_memcpy(grown.mobjs, block->mobjs, n * sizeof(mobj_t*));
+            doom_memcpy(grown.x, block->x, n * sizeof(fixed_t));
+            doom_memcpy(grown.y, block->y, n * sizeof(fixed_t));
+            doom_memcpy(grown.radius, block->radius, n * sizeof(fixed_t));
+            Z_Free(block->mobjs);
+        }
+
+        block->mobjs = grown.mobjs;
+        block->x = grown.x;
+        block->y = grown.y;
+        block->radius = grown.radius;
+        block->max = max;
+    }
+
+    n = block->count++;
+    block->mobjs[n] = thing;
+    block->x[n] = thing->x;
+    block->y[n] = thing->y;
+    block->radius[n] = thing->radius;
+}
+
+
+//
+// P_UnlinkBlockThing
+//
+void P_UnlinkBlockThing(blockthings_t* block, mobj_t* thing)
+{
+    int i;
+
+    for (i = block->count - 1; i >= 0; i--)
+        if (block->mobjs[i] == thing)
+            break;
+
+    if (i < 0)
+        return;
+
+    if (blockwalking)
+    {
+        // keep the place of the things after it
+        block->mobjs[i] = 0;
+        block->removed++;
+        return;
+    }
+
+    block->count--;
+    for (; i < block->count; i++)
+    {
+        block->mobjs[i] = block->mobjs[i + 1];
+        block->x[i] = block->x[i + 1];
+        block->y[i] = block->y[i + 1];
+        block->radius[i] = block->radius[i + 1];
+    }
+}
+
+
 //
 // P_UnsetThingPosition
 // Unlinks a thing from block map and sectors.
@@ -29881,21 +31135,13 @@ void P_UnsetThingPosition(mobj_t* thing)
     {
         // inert things don't need to be in blockmap
         // unlink from block map
-        if (thing->bnext)
-            thing->bnext->bprev = thing->bprev;
+        blockx = (thing->x - bmaporgx) >> MAPBLOCKSHIFT;
+        blocky = (thing->y - bmaporgy) >> MAPBLOCKSHIFT;
 
-        if (thing->bprev)
-            thing->bprev->bnext = thing->bnext;
-        else
+        if (blockx >= 0 && blockx < bmapwidth
+            && blocky >= 0 && blocky < bmapheight)
         {
-            blockx = (thing->x - bmaporgx) >> MAPBLOCKSHIFT;
-            blocky = (thing->y - bmaporgy) >> MAPBLOCKSHIFT;
-
-            if (blockx >= 0 && blockx < bmapwidth
-                && blocky >= 0 && blocky < bmapheight)
-            {
-                blocklinks[blocky * bmapwidth + blockx] = thing->bnext;
-            }
+            P_UnlinkBlockThing(&blockthings[blocky * bmapwidth + blockx], thing);
         }
     }
 }
@@ -29913,7 +31159,6 @@ void P_SetThingPosition(mobj_t* thing)
     sector_t* sec;
     int blockx;
     int blocky;
-    mobj_t** link;
 
 
     // link into subsector
@@ -29946,19 +31191,10 @@ void P_SetThingPosition(mobj_t* thing)
             && blocky >= 0
             && blocky < bmapheight)
         {
-            link = &blocklinks[blocky * bmapwidth + blockx];
-            thing->bprev = 0;
-            thing->bnext = *link;
-            if (*link)
-                (*link)->bprev = thing;
-
-            *link = thing;
-        }
-        else
-        {
-            // thing is off the map
-            thing->bnext = thing->bprev = 0;
+            P_LinkBlockThing(&blockthings[blocky * bmapwidth + blockx], thing);
         }
+
+        // things off the map aren't in any block
     }
 }
 
@@ -29982,7 +31218,7 @@ void P_SetThingPosition(mobj_t* thing)
 doom_boolean P_BlockLinesIterator(int x, int y, doom_boolean(*func)(line_t*))
 {
     int offset;
-    short* list;
+    int* list;
     line_t* ld;
 
     if (x < 0
@@ -30018,7 +31254,9 @@ doom_boolean P_BlockLinesIterator(int x, int y, doom_boolean(*func)(line_t*))
 //
 doom_boolean P_BlockThingsIterator(int x, int y, doom_boolean(*func)(mobj_t*))
 {
+    blockthings_t* block;
     mobj_t* mobj;
+    int i;
 
     if (x < 0
         || y < 0
@@ -30028,14 +31266,70 @@ doom_boolean P_BlockThingsIterator(int x, int y, doom_boolean(*func)(mobj_t*))
         return true;
     }
 
+    block = &blockthings[y * bmapwidth + x];
+    blockwalking++;
 
-    for (mobj = blocklinks[y * bmapwidth + x];
-         mobj;
-         mobj = mobj->bnext)
+    // func may link things into this block,
+    //  which can move the columns
+    for (i = block->count - 1; i >= 0; i--)
     {
-        if (!func(mobj))
+        mobj = block->mobjs[i];
+        if (mobj && !func(mobj))
+        {
+            blockwalking--;
             return false;
+        }
     }
+
+    blockwalking--;
+    return true;
+}
+
+
+//
+// P_BlockThingsNear
+// Like P_BlockThingsIterator, but only calls func
+// for things that could be within reach of px, py,
+// that is, whose box grown by reach holds the point.
+// Callers whose func would ignore a farther thing
+// get the same results, faster.
+//
+doom_boolean P_BlockThingsNear(int x, int y, fixed_t px, fixed_t py, fixed_t reach, doom_boolean(*func)(mobj_t*))
+{
+    blockthings_t* block;
+    mobj_t* mobj;
+    fixed_t dist;
+    int i;
+
+    if (x < 0
+        || y < 0
+        || x >= bmapwidth
+        || y >= bmapheight)
+    {
+        return true;
+    }
+
+    block = &blockthings[y * bmapwidth + x];
+    blockwalking++;
+
+    for (i = block->count - 1; i >= 0; i--)
+    {
+        dist = block->radius[i] + reach;
+        if (doom_abs(block->x[i] - px) >= dist
+            || doom_abs(block->y[i] - py) >= dist)
+        {
+            continue;
+        }
+
+        mobj = block->mobjs[i];
+        if (mobj && !func(mobj))
+        {
+            blockwalking--;
+            return false;
+        }
+    }
+
+    blockwalking--;
     return true;
 }
 
@@ -30044,6 +31338,21 @@ doom_boolean P_BlockThingsIterator(int x, int y, doom_boolean(*func)(mobj_t*))
 // INTERCEPT ROUTINES
 //
 
+//
+// P_GrowIntercepts
+// Makes room for one more intercept.
+//
+void P_GrowIntercepts(void)
+{
+    int count;
+
+    count = (int)(intercept_p - intercepts);
+    intercepts = R_GrowArray(intercepts, &maxintercepts,
+                             sizeof(*intercepts), MAXINTERCEPTS);
+    intercept_p = intercepts + count;
+}
+
+
 //
 // PIT_AddLineIntercepts.
 // Looks for lines in the given block
@@ -30094,6 +31403,9 @@ doom_boolean PIT_AddLineIntercepts(line_t* ld)
         return false; // stop checking
     }
 
+    if (intercept_p == intercepts + maxintercepts)
+        P_GrowIntercepts();
+
     intercept_p->frac = frac;
     intercept_p->isaline = true;
     intercept_p->d.line = ld;
@@ -30158,6 +31470,9 @@ doom_boolean PIT_AddThingIntercepts(mobj_t* thing)
     if (frac < 0)
         return true; // behind source
 
+    if (intercept_p == intercepts + maxintercepts)
+        P_GrowIntercepts();
+
     intercept_p->frac = frac;
     intercept_p->isaline = false;
     intercept_p->d.thing = thing;
@@ -30171,49 +31486,36 @@ doom_boolean PIT_AddThingIntercepts(mobj_t* thing)
 // P_TraverseIntercepts
 // Returns true if the traverser function returns true
 // for all lines.
+// The intercepts are sorted by frac, keeping the order
+// they were added in for equal fracs, which visits them
+// as the old closest-first rescan did.
+// They are mostly added in order already, block by block
+// along the trace, so an insertion sort has little to do.
 // 
 doom_boolean P_TraverseIntercepts(traverser_t func, fixed_t maxfrac)
 {
-    int count;
-    fixed_t dist;
     intercept_t* scan;
     intercept_t* in;
+    intercept_t hold;
 
-    count = (int)(intercept_p - intercepts);
+    for (scan = intercepts + 1; scan < intercept_p; scan++)
+    {
+        if (scan[-1].frac <= scan->frac)
+            continue;
 
-    in = 0;                        // shut up compiler warning
+        hold = *scan;
+        for (in = scan; in > intercepts && in[-1].frac > hold.frac; in--)
+            *in = in[-1];
+        *in = hold;
+    }
 
-    while (count--)
+    for (in = intercepts; in < intercept_p; in++)
     {
-        dist = DOOM_MAXINT;
-        for (scan = intercepts; scan < intercept_p; scan++)
-        {
-            if (scan->frac < dist)
-            {
-                dist = scan->frac;
-                in = scan;
-            }
-        }
-
-        if (dist > maxfrac)
+        if (in->frac > maxfrac)
             return true;        // checked everything in range                
 
-#if 0  // UNUSED
-        {
-            // don't check these yet, there may be others inserted
-            in = scan = intercepts;
-            for (scan = intercepts; scan < intercept_p; scan++)
-                if (scan->frac > maxfrac)
-                    *in++ = *scan;
-            intercept_p = in;
-            return false;
-        }
-#endif
-
         if (!func(in))
             return false;        // don't bother going farther
-
-        in->frac = DOOM_MAXINT;
     }
 
     return true;                // everything was traversed
@@ -30253,6 +31555,8 @@ doom_boolean P_PathTraverse(fixed_t x1, fixed_t y1, fixed_t x2, fixed_t y2, int
     earlyout = flags & PT_EARLYOUT;
 
     validcount++;
+    if (!maxintercepts)
+        P_GrowIntercepts();
     intercept_p = intercepts;
 
     if (((x1 - bmaporgx) & (MAPBLOCKSIZE - 1)) == 0)
@@ -30804,7 +32108,7 @@ mobj_t* P_SpawnMobj(fixed_t x, fixed_t y, fixed_t z, mobjtype_t type)
     state_t* st;
     mobjinfo_t* info;
 
-    mobj = Z_Malloc(sizeof(*mobj), PU_LEVEL, 0);
+    mobj = P_AllocThinker(pool_mobj);
     doom_memset(mobj, 0, sizeof(*mobj));
     info = &mobjinfo[type];
 
@@ -31403,7 +32707,7 @@ int EV_DoPlat(line_t* line, plattype_e type, int amount)
 
         // Find lowest & highest floors around sector
         rtn = 1;
-        plat = Z_Malloc(sizeof(*plat), PU_LEVSPEC, 0);
+        plat = P_AllocThinker(pool_plat);
         P_AddThinker(&plat->thinker);
 
         plat->type = type;
@@ -32522,7 +33826,7 @@ void P_UnArchiveThinkers(void)
         if (currentthinker->function.acp1 == (actionf_p1)P_MobjThinker)
             P_RemoveMobj((mobj_t*)currentthinker);
         else
-            Z_Free(currentthinker);
+            P_FreeThinker(currentthinker);
 
         currentthinker = next;
     }
@@ -32539,7 +33843,7 @@ void P_UnArchiveThinkers(void)
 
             case tc_mobj:
                 PADSAVEP();
-                mobj = Z_Malloc(sizeof(*mobj), PU_LEVEL, 0);
+                mobj = P_AllocThinker(pool_mobj);
                 doom_memcpy(mobj, save_p, sizeof(*mobj));
                 save_p += sizeof(*mobj);
                 mobj->state = &states[(long long)mobj->state];
@@ -32740,7 +34044,7 @@ void P_UnArchiveSpecials(void)
 
             case tc_ceiling:
                 PADSAVEP();
-                ceiling = Z_Malloc(sizeof(*ceiling), PU_LEVEL, 0);
+                ceiling = P_AllocThinker(pool_ceiling);
                 doom_memcpy(ceiling, save_p, sizeof(*ceiling));
                 save_p += sizeof(*ceiling);
                 ceiling->sector = &sectors[(long long)ceiling->sector];
@@ -32755,7 +34059,7 @@ void P_UnArchiveSpecials(void)
 
             case tc_door:
                 PADSAVEP();
-                door = Z_Malloc(sizeof(*door), PU_LEVEL, 0);
+                door = P_AllocThinker(pool_door);
                 doom_memcpy(door, save_p, sizeof(*door));
                 save_p += sizeof(*door);
                 door->sector = &sectors[(long long)door->sector];
@@ -32766,7 +34070,7 @@ void P_UnArchiveSpecials(void)
 
             case tc_floor:
                 PADSAVEP();
-                floor = Z_Malloc(sizeof(*floor), PU_LEVEL, 0);
+                floor = P_AllocThinker(pool_floor);
                 doom_memcpy(floor, save_p, sizeof(*floor));
                 save_p += sizeof(*floor);
                 floor->sector = &sectors[(long long)floor->sector];
@@ -32777,7 +34081,7 @@ void P_UnArchiveSpecials(void)
 
             case tc_plat:
                 PADSAVEP();
-                plat = Z_Malloc(sizeof(*plat), PU_LEVEL, 0);
+                plat = P_AllocThinker(pool_plat);
                 doom_memcpy(plat, save_p, sizeof(*plat));
                 save_p += sizeof(*plat);
                 plat->sector = &sectors[(long long)plat->sector];
@@ -32792,7 +34096,7 @@ void P_UnArchiveSpecials(void)
 
             case tc_flash:
                 PADSAVEP();
-                flash = Z_Malloc(sizeof(*flash), PU_LEVEL, 0);
+                flash = P_AllocThinker(pool_flash);
                 doom_memcpy(flash, save_p, sizeof(*flash));
                 save_p += sizeof(*flash);
                 flash->sector = &sectors[(long long)flash->sector];
@@ -32802,7 +34106,7 @@ void P_UnArchiveSpecials(void)
 
             case tc_strobe:
                 PADSAVEP();
-                strobe = Z_Malloc(sizeof(*strobe), PU_LEVEL, 0);
+                strobe = P_AllocThinker(pool_strobe);
                 doom_memcpy(strobe, save_p, sizeof(*strobe));
                 save_p += sizeof(*strobe);
                 strobe->sector = &sectors[(long long)strobe->sector];
@@ -32812,7 +34116,7 @@ void P_UnArchiveSpecials(void)
 
             case tc_glow:
                 PADSAVEP();
-                glow = Z_Malloc(sizeof(*glow), PU_LEVEL, 0);
+                glow = P_AllocThinker(pool_glow);
                 doom_memcpy(glow, save_p, sizeof(*glow));
                 save_p += sizeof(*glow);
                 glow->sector = &sectors[(long long)glow->sector];
@@ -32833,6 +34137,176 @@ void P_UnArchiveSpecials(void)
         }
     }
 }
+
+
+//
+// SNAPSHOTS
+// In-memory copies of the level, see G_TakeSnapshot.
+// Nothing is swizzled: a snapshot only goes back into
+//  the level it was taken in, whose sectors, lines and
+//  pool slabs are all still where they were, so their
+//  raw bytes are put back, pointers and all.
+// The block lists are written as counts and mobjs,
+//  as their arrays get moved when they grow.
+//
+typedef struct
+{
+    void* data;
+    int size;
+} snapshotpart_t;
+
+snapshotpart_t snapshotparts[] =
+{
+    { &leveltime, sizeof(leveltime) },
+    { &demotic, sizeof(demotic) },
+    { &rndindex, sizeof(rndindex) },
+    { &prndindex, sizeof(prndindex) },
+    { &totalkills, sizeof(totalkills) },
+    { &totalitems, sizeof(totalitems) },
+    { &totalsecret, sizeof(totalsecret) },
+    { &levelTimer, sizeof(levelTimer) },
+    { &levelTimeCount, sizeof(levelTimeCount) },
+    { players, sizeof(players) },
+    { bodyque, sizeof(bodyque) },
+    { &bodyqueslot, sizeof(bodyqueslot) },
+    { itemrespawnque, sizeof(itemrespawnque) },
+    { itemrespawntime, sizeof(itemrespawntime) },
+    { &iquehead, sizeof(iquehead) },
+    { &iquetail, sizeof(iquetail) },
+    { activeceilings, sizeof(activeceilings) },
+    { activeplats, sizeof(activeplats) },
+    { buttonlist, sizeof(buttonlist) },
+    { braintargets, sizeof(braintargets) },
+    { &numbraintargets, sizeof(numbraintargets) },
+    { &braintargeton, sizeof(braintargeton) },
+    { &braineasy, sizeof(braineasy) },
+    { &thinkercap, sizeof(thinkercap) }
+};
+
+#define NUMSNAPSHOTPARTS ((int)(sizeof(snapshotparts) / sizeof(snapshotparts[0])))
+
+
+void P_ArchiveBytes(void* data, int size)
+{
+    doom_memcpy(save_p, data, size);
+    save_p += size;
+}
+
+
+void P_UnArchiveBytes(void* data, int size)
+{
+    doom_memcpy(data, save_p, size);
+    save_p += size;
+}
+
+
+//
+// P_SnapshotSize
+// At least what P_ArchiveSnapshot will write.
+//
+int P_SnapshotSize(void)
+{
+    int size;
+    int i;
+
+    size = sizeof(int);
+    for (i = 0; i < NUMSNAPSHOTPARTS; i++)
+        size += snapshotparts[i].size;
+
+    size += numsectors * sizeof(sector_t);
+    size += numlines * sizeof(line_t);
+    size += numsides * sizeof(side_t);
+    size += P_PoolsSize();
+
+    for (i = 0; i < bmapwidth * bmapheight; i++)
+        size += sizeof(int) + blockthings[i].count * sizeof(mobj_t*);
+
+    return size;
+}
+
+
+//
+// P_ArchiveSnapshot
+// The parts that change the most go last, so that
+//  consecutive snapshots line up for as long as they can.
+//
+void P_ArchiveSnapshot(void)
+{
+    blockthings_t* block;
+    int offset;
+    int count;
+    int i;
+    int j;
+
+    for (i = 0; i < NUMSNAPSHOTPARTS; i++)
+        P_ArchiveBytes(snapshotparts[i].data, snapshotparts[i].size);
+
+    offset = (int)(demo_p - demobuffer);
+    P_ArchiveBytes(&offset, sizeof(offset));
+
+    P_ArchiveBytes(sectors, numsectors * sizeof(sector_t));
+    P_ArchiveBytes(lines, numlines * sizeof(line_t));
+    P_ArchiveBytes(sides, numsides * sizeof(side_t));
+
+    P_ArchivePools();
+
+    // things in each block, oldest first
+    for (i = 0, block = blockthings; i < bmapwidth * bmapheight; i++, block++)
+    {
+        count = block->count - block->removed;
+        P_ArchiveBytes(&count, sizeof(count));
+
+        for (j = 0; j < block->count; j++)
+        {
+            if (block->mobjs[j])
+                P_ArchiveBytes(&block->mobjs[j], sizeof(mobj_t*));
+        }
+    }
+}
+
+
+//
+// P_UnArchiveSnapshot
+//
+void P_UnArchiveSnapshot(void)
+{
+    blockthings_t* block;
+    mobj_t* mobj;
+    int offset;
+    int count;
+    int i;
+    int j;
+
+    for (i = 0; i < NUMSNAPSHOTPARTS; i++)
+        P_UnArchiveBytes(snapshotparts[i].data, snapshotparts[i].size);
+
+    P_UnArchiveBytes(&offset, sizeof(offset));
+    demo_p = demobuffer + offset;
+
+    P_UnArchiveBytes(sectors, numsectors * sizeof(sector_t));
+    P_UnArchiveBytes(lines, numlines * sizeof(line_t));
+    P_UnArchiveBytes(sides, numsides * sizeof(side_t));
+
+    P_UnArchivePools();
+    P_RelinkThinkers();
+
+    // the mobjs are back, so they can be linked again
+    for (i = 0, block = blockthings; i < bmapwidth * bmapheight; i++, block++)
+    {
+        P_UnArchiveBytes(&count, sizeof(count));
+        block->count = 0;
+        block->removed = 0;
+
+        for (j = 0; j < count; j++)
+        {
+            P_UnArchiveBytes(&mobj, sizeof(mobj));
+            P_LinkBlockThing(block, mobj);
+        }
+    }
+
+    // cached sight checks are about the old positions
+    sightepoch++;
+}
 #define MAX_DEATHMATCH_STARTS        10
 
 
@@ -32871,14 +34345,14 @@ side_t* sides;
 // Blockmap size.
 int bmapwidth;
 int bmapheight; // size in mapblocks
-short* blockmap; // int for larger maps
+int* blockmap; // int for larger maps
 // offsets in blockmap are from here
-short* blockmaplump;
+int* blockmaplump;
 // origin of block map
 fixed_t bmaporgx;
 fixed_t bmaporgy;
 // for thing chains
-mobj_t** blocklinks;
+blockthings_t* blockthings;
 
 // REJECT
 // For fast sight rejection.
@@ -32893,10 +34367,95 @@ mapthing_t deathmatchstarts[MAX_DEATHMATCH_STARTS];
 mapthing_t* deathmatch_p;
 mapthing_t playerstarts[MAXPLAYERS];
 
+// -setupreport: P_SetupLevel prints how long each
+//  stage of loading the level took.
+typedef enum
+{
+    setup_vertexes,
+    setup_sectors,
+    setup_sidedefs,
+    setup_linedefs,
+    setup_blockmap,
+    setup_subsectors,
+    setup_nodes,
+    setup_segs,
+    setup_reject,
+    setup_grouplines,
+    setup_things,
+    setup_specials,
+    setup_precache,
+    NUMSETUPSTAGES
+} setupstage_t;
+
+char* setupstagenames[NUMSETUPSTAGES] =
+{
+    "vertexes", "sectors", "sidedefs", "linedefs", "blockmap",
+    "subsectors", "nodes", "segs", "reject", "grouplines",
+    "things", "specials", "precache"
+};
+
+doom_boolean setupreport;
+int setupusec[NUMSETUPSTAGES];
+int setupmarksec;
+int setupmarkusec;
+
 
 void P_SpawnMapThing(mapthing_t* mthing);
 
 
+//
+// P_SetupMark
+// Charges the time since the last mark to stage,
+// or just starts the clock if stage is -1.
+//
+void P_SetupMark(int stage)
+{
+    int sec;
+    int usec;
+
+    doom_gettime(&sec, &usec);
+    if (stage >= 0)
+        setupusec[stage] = (sec - setupmarksec) * 1000000 + usec - setupmarkusec;
+    else
+        doom_memset(setupusec, 0, sizeof(setupusec));
+
+    setupmarksec = sec;
+    setupmarkusec = usec;
+}
+
+
+//
+// P_SetupReport
+//
+void P_SetupReport(char* lumpname)
+{
+    int i;
+    int total;
+
+    total = 0;
+    for (i = 0; i < NUMSETUPSTAGES; i++)
+        total += setupusec[i];
+
+    //doom_print("P_SetupLevel: %s in %i us:", lumpname, total);
+    doom_print("P_SetupLevel: ");
+    doom_print(lumpname);
+    doom_print(" in ");
+    doom_print(doom_itoa(total, 10));
+    doom_print(" us:");
+
+    for (i = 0; i < NUMSETUPSTAGES; i++)
+    {
+        //doom_print(" %s %i", setupstagenames[i], setupusec[i]);
+        doom_print(" ");
+        doom_print(setupstagenames[i]);
+        doom_print(" ");
+        doom_print(doom_itoa(setupusec[i], 10));
+    }
+
+    doom_print("\n");
+}
+
+
 //
 // P_LoadVertexes
 //
@@ -33046,6 +34605,7 @@ void P_LoadNodes(int lump)
     int i;
     int j;
     int k;
+    unsigned child;
     mapnode_t* mn;
     node_t* no;
 
@@ -33064,7 +34624,11 @@ void P_LoadNodes(int lump)
         no->dy = SHORT(mn->dy) << FRACBITS;
         for (j = 0; j < 2; j++)
         {
-            no->children[j] = SHORT(mn->children[j]);
+            child = (unsigned short)SHORT(mn->children[j]);
+            if (child & NF_MAPSUBSECTOR)
+                child = (child & ~NF_MAPSUBSECTOR) | NF_SUBSECTOR;
+
+            no->children[j] = child;
             for (k = 0; k < 4; k++)
                 no->bbox[j][k] = SHORT(mn->bbox[j][k]) << FRACBITS;
         }
@@ -33074,6 +34638,266 @@ void P_LoadNodes(int lump)
 }
 
 
+//
+// EXTENDED NODES
+// Node builders write XNOD into the NODES lump for maps
+// too big for the vanilla formats, with SEGS and SSECTORS
+// left empty. Everything is little endian, with 32 bit
+// vertex, seg, subsector and child numbers:
+//  "XNOD"
+//  original and new vertex counts, new vertexes (x, y fixed)
+//  subsector count, segs in each subsector
+//  seg count, segs (v1, v2, short linedef, byte side)
+//  node count, nodes (shorts as in mapnode_t, int children)
+// ZNOD is the same, deflated; there is no zlib here.
+//
+
+byte* xnodp;
+byte* xnodend;
+
+
+//
+// P_ExtendedNodes
+// Returns true if the NODES lump is XNOD.
+//
+doom_boolean P_ExtendedNodes(int lump)
+{
+    byte* data;
+    doom_boolean extended;
+
+    if (W_LumpLength(lump) < 4)
+        return false;
+
+    data = W_CacheLumpNum(lump, PU_STATIC);
+    extended = !doom_strncmp((char*)data, "XNOD", 4);
+
+    if (!doom_strncmp((char*)data, "ZNOD", 4)
+        || !doom_strncmp((char*)data, "XGLN", 4)
+        || !doom_strncmp((char*)data, "ZGLN", 4))
+    {
+        I_Error("Error: P_ExtendedNodes: only uncompressed, non GL extended nodes (XNOD) are supported");
+    }
+
+    Z_Free(data);
+    return extended;
+}
+
+
+//
+// P_XNODBytes
+// Returns the next count bytes of the lump.
+//
+byte* P_XNODBytes(int count)
+{
+    byte* p;
+
+    if (xnodend - xnodp < count)
+        I_Error("Error: P_LoadExtendedNodes: NODES lump is truncated");
+
+    p = xnodp;
+    xnodp += count;
+    return p;
+}
+
+
+int P_XNODLong(void)
+{
+    byte* p;
+
+    p = P_XNODBytes(4);
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned)p[3] << 24);
+}
+
+
+short P_XNODShort(void)
+{
+    byte* p;
+
+    p = P_XNODBytes(2);
+    return (short)(p[0] | (p[1] << 8));
+}
+
+
+//
+// P_XNODCount
+// Reads a count or index, which must be below max.
+//
+int P_XNODCount(int max)
+{
+    unsigned value;
+
+    value = (unsigned)P_XNODLong();
+    if (value >= (unsigned)max)
+        I_Error("Error: P_LoadExtendedNodes: bad count or index");
+
+    return (int)value;
+}
+
+
+//
+// P_SegOffset
+// Distance along the linedef to the start of a seg,
+// which XNOD leaves for the engine to work out.
+//
+fixed_t P_SegOffset(vertex_t* v, vertex_t* start)
+{
+    long long dx;
+    long long dy;
+    unsigned long long dist;
+    unsigned long long root;
+    unsigned long long bit;
+
+    // in 1/256 units, so the squares can't overflow
+    dx = ((long long)v->x - start->x) >> 8;
+    dy = ((long long)v->y - start->y) >> 8;
+    dist = dx * dx + dy * dy;
+
+    root = 0;
+    bit = 1ULL << 62;
+    while (bit > dist)
+        bit >>= 2;
+
+    while (bit)
+    {
+        if (dist >= root + bit)
+        {
+            dist -= root + bit;
+            root = (root >> 1) + bit;
+        }
+        else
+            root >>= 1;
+
+        bit >>= 2;
+    }
+
+    return (fixed_t)(root << 8);
+}
+
+
+//
+// P_LoadExtendedNodes
+// Loads vertexes added by the node builder, subsectors,
+// segs and nodes, all from an XNOD lump.
+//
+void P_LoadExtendedNodes(int lump)
+{
+    byte* data;
+    vertex_t* newvertexes;
+    line_t* ld;
+    line_t* ldef;
+    seg_t* li;
+    subsector_t* ss;
+    node_t* no;
+    int orgverts;
+    int i;
+    int j;
+    int k;
+    int first;
+    int linedef;
+    int side;
+
+    data = W_CacheLumpNum(lump, PU_STATIC);
+    xnodp = data + 4;
+    xnodend = data + W_LumpLength(lump);
+
+    // vertexes, the originals then the builder's
+    orgverts = P_XNODCount(numvertexes + 1);
+    i = P_XNODCount(0x7fffffff / sizeof(vertex_t) - orgverts);
+
+    newvertexes = Z_Malloc((orgverts + i) * sizeof(vertex_t), PU_LEVEL, 0);
+    doom_memcpy(newvertexes, vertexes, orgverts * sizeof(vertex_t));
+    for (j = orgverts; j < orgverts + i; j++)
+    {
+        newvertexes[j].x = P_XNODLong();
+        newvertexes[j].y = P_XNODLong();
+    }
+
+    // the lines point into the old array
+    for (j = 0, ld = lines; j < numlines; j++, ld++)
+    {
+        ld->v1 = newvertexes + (ld->v1 - vertexes);
+        ld->v2 = newvertexes + (ld->v2 - vertexes);
+    }
+
+    Z_Free(vertexes);
+    vertexes = newvertexes;
+    numvertexes = orgverts + i;
+
+    // subsectors, whose segs follow on from each other
+    numsubsectors = P_XNODCount(0x7fffffff / sizeof(subsector_t));
+    subsectors = Z_Malloc(numsubsectors * sizeof(subsector_t), PU_LEVEL, 0);
+    doom_memset(subsectors, 0, numsubsectors * sizeof(subsector_t));
+
+    first = 0;
+    for (i = 0, ss = subsectors; i < numsubsectors; i++, ss++)
+    {
+        ss->firstline = first;
+        ss->numlines = P_XNODCount(0x7fffffff - first);
+        first += ss->numlines;
+    }
+
+    // segs
+    numsegs = P_XNODCount(0x7fffffff / sizeof(seg_t));
+    if (numsegs != first)
+        I_Error("Error: P_LoadExtendedNodes: subsectors and segs disagree");
+
+    segs = Z_Malloc(numsegs * sizeof(seg_t), PU_LEVEL, 0);
+    doom_memset(segs, 0, numsegs * sizeof(seg_t));
+
+    for (i = 0, li = segs; i < numsegs; i++, li++)
+    {
+        li->v1 = &vertexes[P_XNODCount(numvertexes)];
+        li->v2 = &vertexes[P_XNODCount(numvertexes)];
+        linedef = (unsigned short)P_XNODShort();
+        side = *P_XNODBytes(1);
+
+        // GL minisegs have no linedef
+        if (linedef >= numlines || side > 1)
+            I_Error("Error: P_LoadExtendedNodes: bad seg linedef");
+
+        ldef = &lines[linedef];
+        li->linedef = ldef;
+        li->angle = R_PointToAngle2(li->v1->x, li->v1->y, li->v2->x, li->v2->y);
+        li->offset = P_SegOffset(li->v1, side ? ldef->v2 : ldef->v1);
+        li->sidedef = &sides[ldef->sidenum[side]];
+        li->frontsector = sides[ldef->sidenum[side]].sector;
+        if (ldef->flags & ML_TWOSIDED)
+            li->backsector = sides[ldef->sidenum[side ^ 1]].sector;
+        else
+            li->backsector = 0;
+    }
+
+    // nodes
+    numnodes = P_XNODCount(0x7fffffff / sizeof(node_t));
+    nodes = Z_Malloc(numnodes * sizeof(node_t), PU_LEVEL, 0);
+
+    for (i = 0, no = nodes; i < numnodes; i++, no++)
+    {
+        no->x = P_XNODShort() << FRACBITS;
+        no->y = P_XNODShort() << FRACBITS;
+        no->dx = P_XNODShort() << FRACBITS;
+        no->dy = P_XNODShort() << FRACBITS;
+
+        for (j = 0; j < 2; j++)
+            for (k = 0; k < 4; k++)
+                no->bbox[j][k] = P_XNODShort() << FRACBITS;
+
+        for (j = 0; j < 2; j++)
+        {
+            no->children[j] = (unsigned)P_XNODLong();
+            if (no->children[j] & NF_SUBSECTOR
+                ? (no->children[j] & ~NF_SUBSECTOR) >= (unsigned)numsubsectors
+                : no->children[j] >= (unsigned)numnodes)
+            {
+                I_Error("Error: P_LoadExtendedNodes: bad node child");
+            }
+        }
+    }
+
+    Z_Free(data);
+}
+
+
 //
 // P_LoadThings
 //
@@ -33242,30 +35066,323 @@ void P_LoadSideDefs(int lump)
 }
 
 
+//
+// BLOCKMAP
+// The lump is held as ints, read with unsigned offsets
+// and line numbers. A missing lump, or one that doesn't
+// check out (large maps overflow its 16 bit offsets),
+// is replaced by one built from the lines here. Built
+// blockmaps are kept across levels, keyed by a hash of
+// the lines, so restarting a level doesn't rebuild.
+//
+#define BLOCKMAPCACHE 4
+
+typedef struct
+{
+    unsigned key;
+    int size;
+    int* data;
+} blockmapcache_t;
+
+blockmapcache_t blockmapcache[BLOCKMAPCACHE];
+int blockmapcachenext;
+
+
+//
+// P_ReadBlockMap
+// Returns false if the lump is no good.
+//
+doom_boolean P_ReadBlockMap(short* data, int count)
+{
+    int i;
+    int first;
+    int value;
+
+    if (count < 4)
+        return false;
+
+    bmapwidth = SHORT(data[2]);
+    bmapheight = SHORT(data[3]);
+    first = 4 + bmapwidth * bmapheight;
+
+    // offsets past 0xffff have wrapped
+    if (bmapwidth <= 0 || bmapheight <= 0
+        || first >= count || count > 0x10000
+        || SHORT(data[count - 1]) != -1)
+    {
+        return false;
+    }
+
+    blockmaplump = Z_Malloc(count * sizeof(int), PU_LEVEL, 0);
+    blockmaplump[0] = SHORT(data[0]);
+    blockmaplump[1] = SHORT(data[1]);
+    blockmaplump[2] = bmapwidth;
+    blockmaplump[3] = bmapheight;
+
+    for (i = 4; i < count; i++)
+    {
+        value = (unsigned short)SHORT(data[i]);
+
+        if (i < first)
+        {
+            if (value < first || value >= count)
+                break;
+        }
+        else if (value == 0xffff)
+            value = -1;
+        else if (value >= numlines)
+            break;
+
+        blockmaplump[i] = value;
+    }
+
+    if (i < count)
+    {
+        Z_Free(blockmaplump);
+        return false;
+    }
+
+    return true;
+}
+
+
+//
+// P_BlockMapKey
+// Hashes what a built blockmap depends on.
+//
+unsigned P_BlockMapKey(void)
+{
+    unsigned key;
+    byte* p;
+    int i;
+    int j;
+    int words[4];
+
+    // FNV-1a
+    key = 2166136261u;
+
+    for (i = 0; i < numlines; i++)
+    {
+        words[0] = lines[i].v1->x;
+        words[1] = lines[i].v1->y;
+        words[2] = lines[i].v2->x;
+        words[3] = lines[i].v2->y;
+
+        for (p = (byte*)words, j = 0; j < (int)sizeof(words); j++)
+            key = (key ^ p[j]) * 16777619u;
+    }
+
+    return key ^ numlines;
+}
+
+
+//
+// P_LineInBlock
+// True if the line touches the block with its
+// bottom left corner at x, y.
+//
+doom_boolean P_LineInBlock(line_t* ld, fixed_t x, fixed_t y)
+{
+    long long side;
+    int i;
+    int front;
+    int back;
+
+    front = back = 0;
+    for (i = 0; i < 4; i++)
+    {
+        side = (long long)ld->dx * ((y + (i >> 1) * MAPBLOCKSIZE) - ld->v1->y)
+            - (long long)ld->dy * ((x + (i & 1) * MAPBLOCKSIZE) - ld->v1->x);
+
+        if (side >= 0)
+            front = 1;
+        if (side <= 0)
+            back = 1;
+    }
+
+    return front && back;
+}
+
+
+//
+// P_CreateBlockMap
+// Lists every line in each block it touches,
+// with the leading 0 vanilla lists have. Empty
+// blocks all share one list.
+//
+void P_CreateBlockMap(void)
+{
+    fixed_t bbox[4];
+    line_t* ld;
+    blockmapcache_t* entry;
+    int* counts;
+    int* list;
+    int i;
+    int x;
+    int y;
+    int xl;
+    int xh;
+    int yl;
+    int yh;
+    int pass;
+    int size;
+    int empty;
+    int numblocks;
+    fixed_t orgx;
+    fixed_t orgy;
+
+    M_ClearBox(bbox);
+    for (i = 0; i < numvertexes; i++)
+        M_AddToBox(bbox, vertexes[i].x, vertexes[i].y);
+
+    orgx = bbox[BOXLEFT] >> FRACBITS;
+    orgy = bbox[BOXBOTTOM] >> FRACBITS;
+    bmaporgx = orgx << FRACBITS;
+    bmaporgy = orgy << FRACBITS;
+    bmapwidth = ((bbox[BOXRIGHT] - bmaporgx) >> MAPBLOCKSHIFT) + 1;
+    bmapheight = ((bbox[BOXTOP] - bmaporgy) >> MAPBLOCKSHIFT) + 1;
+    numblocks = bmapwidth * bmapheight;
+
+    counts = doom_malloc(numblocks * sizeof(int));
+    doom_memset(counts, 0, numblocks * sizeof(int));
+    list = 0;
+    size = 0;
+
+    // count the lines in each block, then lay the
+    //  lists out and go over the lines again to fill them
+    for (pass = 0; pass < 2; pass++)
+    {
+        for (i = 0, ld = lines; i < numlines; i++, ld++)
+        {
+            xl = ((ld->bbox[BOXLEFT] - bmaporgx) >> MAPBLOCKSHIFT);
+            xh = ((ld->bbox[BOXRIGHT] - bmaporgx) >> MAPBLOCKSHIFT);
+            yl = ((ld->bbox[BOXBOTTOM] - bmaporgy) >> MAPBLOCKSHIFT);
+            yh = ((ld->bbox[BOXTOP] - bmaporgy) >> MAPBLOCKSHIFT);
+
+            for (y = yl; y <= yh; y++)
+            {
+                for (x = xl; x <= xh; x++)
+                {
+                    // a line in one row or column
+                    //  touches every block of its box
+                    if (xl != xh && yl != yh
+                        && !P_LineInBlock(ld, bmaporgx + (x << MAPBLOCKSHIFT),
+                                          bmaporgy + (y << MAPBLOCKSHIFT)))
+                    {
+                        continue;
+                    }
+
+                    if (pass)
+                        blockmaplump[counts[y * bmapwidth + x]++] = i;
+                    else
+                        counts[y * bmapwidth + x]++;
+                }
+            }
+        }
+
+        if (pass)
+            break;
+
+        size = 4 + numblocks + 2;
+        for (i = 0; i < numblocks; i++)
+            if (counts[i])
+                size += counts[i] + 2;
+
+        blockmaplump = Z_Malloc(size * sizeof(int), PU_LEVEL, 0);
+        blockmaplump[0] = orgx;
+        blockmaplump[1] = orgy;
+        blockmaplump[2] = bmapwidth;
+        blockmaplump[3] = bmapheight;
+
+        empty = 4 + numblocks;
+        blockmaplump[empty] = 0;
+        blockmaplump[empty + 1] = -1;
+
+        list = blockmaplump + empty + 2;
+        for (i = 0; i < numblocks; i++)
+        {
+            if (!counts[i])
+            {
+                blockmaplump[4 + i] = empty;
+                continue;
+            }
+
+            blockmaplump[4 + i] = (int)(list - blockmaplump);
+            list[0] = 0;
+            list[counts[i] + 1] = -1;
+            list += counts[i] + 2;
+
+            // where the next line goes
+            counts[i] = blockmaplump[4 + i] + 1;
+        }
+    }
+
+    doom_free(counts);
+
+    // keep it for next time
+    entry = &blockmapcache[blockmapcachenext];
+    blockmapcachenext = (blockmapcachenext + 1) % BLOCKMAPCACHE;
+
+    if (entry->data)
+        doom_free(entry->data);
+
+    entry->key = P_BlockMapKey();
+    entry->size = size;
+    entry->data = doom_malloc(size * sizeof(int));
+    doom_memcpy(entry->data, blockmaplump, size * sizeof(int));
+}
+
+
 //
 // P_LoadBlockMap
 //
 void P_LoadBlockMap(int lump)
 {
-    int i;
+    short* data;
     int count;
+    int i;
+    unsigned key;
 
-    blockmaplump = W_CacheLumpNum(lump, PU_LEVEL);
-    blockmap = blockmaplump + 4;
     count = W_LumpLength(lump) / 2;
 
-    for (i = 0; i < count; i++)
-        blockmaplump[i] = SHORT(blockmaplump[i]);
+    if (!M_CheckParm("-blockmap"))
+    {
+        data = W_CacheLumpNum(lump, PU_STATIC);
+        i = P_ReadBlockMap(data, count);
+        Z_Free(data);
 
-    bmaporgx = blockmaplump[0] << FRACBITS;
-    bmaporgy = blockmaplump[1] << FRACBITS;
-    bmapwidth = blockmaplump[2];
-    bmapheight = blockmaplump[3];
+        if (i)
+        {
+            bmaporgx = blockmaplump[0] << FRACBITS;
+            bmaporgy = blockmaplump[1] << FRACBITS;
+            goto done;
+        }
+    }
+
+    key = P_BlockMapKey();
+    for (i = 0; i < BLOCKMAPCACHE; i++)
+    {
+        if (blockmapcache[i].data && blockmapcache[i].key == key)
+        {
+            blockmaplump = Z_Malloc(blockmapcache[i].size * sizeof(int), PU_LEVEL, 0);
+            doom_memcpy(blockmaplump, blockmapcache[i].data, blockmapcache[i].size * sizeof(int));
+            bmaporgx = blockmaplump[0] << FRACBITS;
+            bmaporgy = blockmaplump[1] << FRACBITS;
+            bmapwidth = blockmaplump[2];
+            bmapheight = blockmaplump[3];
+            goto done;
+        }
+    }
+
+    P_CreateBlockMap();
+
+done:
+    blockmap = blockmaplump + 4;
 
     // clear out mobj chains
-    count = sizeof(*blocklinks) * bmapwidth * bmapheight;
-    blocklinks = Z_Malloc(count, PU_LEVEL, 0);
-    doom_memset(blocklinks, 0, count);
+    count = sizeof(*blockthings) * bmapwidth * bmapheight;
+    blockthings = Z_Malloc(count, PU_LEVEL, 0);
+    doom_memset(blockthings, 0, count);
 }
 
 
@@ -33310,25 +35427,40 @@ void P_GroupLines(void)
         }
     }
 
-    // build line tables for each sector        
+    // build line tables for each sector,
+    //  with one pass over the lines that drops each
+    //  into its sectors, in the same line order as
+    //  a search of all lines per sector would give
     linebuffer = Z_Malloc(total * sizeof(line_t*), PU_LEVEL, 0);
     sector = sectors;
     for (i = 0; i < numsectors; i++, sector++)
     {
-        M_ClearBox(bbox);
         sector->lines = linebuffer;
-        li = lines;
-        for (j = 0; j < numlines; j++, li++)
+        linebuffer += sector->linecount;
+        sector->linecount = 0;
+    }
+
+    li = lines;
+    for (i = 0; i < numlines; i++, li++)
+    {
+        sector = li->frontsector;
+        sector->lines[sector->linecount++] = li;
+
+        sector = li->backsector;
+        if (sector && sector != li->frontsector)
+            sector->lines[sector->linecount++] = li;
+    }
+
+    sector = sectors;
+    for (i = 0; i < numsectors; i++, sector++)
+    {
+        M_ClearBox(bbox);
+        for (j = 0; j < sector->linecount; j++)
         {
-            if (li->frontsector == sector || li->backsector == sector)
-            {
-                *linebuffer++ = li;
-                M_AddToBox(bbox, li->v1->x, li->v1->y);
-                M_AddToBox(bbox, li->v2->x, li->v2->y);
-            }
+            li = sector->lines[j];
+            M_AddToBox(bbox, li->v1->x, li->v1->y);
+            M_AddToBox(bbox, li->v2->x, li->v2->y);
         }
-        if (linebuffer - sector->lines != sector->linecount)
-            I_Error("Error: P_GroupLines: miscounted");
 
         // set the degenmobj_t to the middle of the bounding box
         sector->soundorg.x = (bbox[BOXRIGHT] + bbox[BOXLEFT]) / 2;
@@ -33378,9 +35510,13 @@ void P_SetupLevel(int episode, int map, int playermask, skill_t skill)
     // Make sure all sounds are stopped before Z_FreeTags.
     S_Start();
 
+    // and the old level's precache, which may be loading
+    R_ClearPrecache();
+
     Z_FreeTags(PU_LEVEL, PU_PURGELEVEL - 1);
 
     // UNUSED W_Profile ();
+    P_InitPools();
     P_InitThinkers();
 
     // if working with a devlopment map, reload it
@@ -33416,18 +35552,40 @@ void P_SetupLevel(int episode, int map, int playermask, skill_t skill)
     leveltime = 0;
 
     // note: most of this ordering is important        
-    P_LoadBlockMap(lumpnum + ML_BLOCKMAP);
+    P_SetupMark(-1);
     P_LoadVertexes(lumpnum + ML_VERTEXES);
+    P_SetupMark(setup_vertexes);
     P_LoadSectors(lumpnum + ML_SECTORS);
+    P_SetupMark(setup_sectors);
     P_LoadSideDefs(lumpnum + ML_SIDEDEFS);
+    P_SetupMark(setup_sidedefs);
 
     P_LoadLineDefs(lumpnum + ML_LINEDEFS);
-    P_LoadSubsectors(lumpnum + ML_SSECTORS);
-    P_LoadNodes(lumpnum + ML_NODES);
-    P_LoadSegs(lumpnum + ML_SEGS);
+    P_SetupMark(setup_linedefs);
+
+    // checked against the lines, or built from them
+    P_LoadBlockMap(lumpnum + ML_BLOCKMAP);
+    P_SetupMark(setup_blockmap);
+    if (P_ExtendedNodes(lumpnum + ML_NODES))
+    {
+        // subsectors and segs are in the NODES lump
+        P_LoadExtendedNodes(lumpnum + ML_NODES);
+        P_SetupMark(setup_nodes);
+    }
+    else
+    {
+        P_LoadSubsectors(lumpnum + ML_SSECTORS);
+        P_SetupMark(setup_subsectors);
+        P_LoadNodes(lumpnum + ML_NODES);
+        P_SetupMark(setup_nodes);
+        P_LoadSegs(lumpnum + ML_SEGS);
+        P_SetupMark(setup_segs);
+    }
 
     rejectmatrix = W_CacheLumpNum(lumpnum + ML_REJECT, PU_LEVEL);
+    P_SetupMark(setup_reject);
     P_GroupLines();
+    P_SetupMark(setup_grouplines);
 
     bodyqueslot = 0;
     deathmatch_p = deathmatchstarts;
@@ -33447,12 +35605,19 @@ void P_SetupLevel(int episode, int map, int playermask, skill_t skill)
     // clear special respawning que
     iquehead = iquetail = 0;
 
+    P_SetupMark(setup_things);
+
     // set up world state
     P_SpawnSpecials();
+    P_SetupMark(setup_specials);
 
     // preload graphics
     if (precache)
         R_PrecacheLevel();
+    P_SetupMark(setup_precache);
+
+    if (setupreport)
+        P_SetupReport(lumpname);
 }
 
 
@@ -33461,19 +35626,85 @@ void P_SetupLevel(int episode, int map, int playermask, skill_t skill)
 //
 void P_Init(void)
 {
+    int p;
+
+    // Sight checks on the worker threads, see P_BatchSight.
+    p = M_CheckParm("-sightbatch");
+    if (p)
+    {
+        sightbatch = true;
+        if (p < myargc - 1)
+            I_InitWorkers(doom_atoi(myargv[p + 1]));
+    }
+
+    setupreport = M_CheckParm("-setupreport");
+
     P_InitSwitchList();
     P_InitPicAnims();
     R_InitSprites(sprnames);
 }
-fixed_t sightzstart; // eye z of looker
-fixed_t topslope;
-fixed_t bottomslope; // slopes to top and bottom of target
+DOOM_THREADLOCAL fixed_t sightzstart; // eye z of looker
+DOOM_THREADLOCAL fixed_t topslope;
+DOOM_THREADLOCAL fixed_t bottomslope; // slopes to top and bottom of target
+
+DOOM_THREADLOCAL divline_t strace; // from t1 to t2
+DOOM_THREADLOCAL fixed_t t2x;
+DOOM_THREADLOCAL fixed_t t2y;
+
+int sightcounts[4];
+
+// Lines already crossed by the current sight check.
+// Each worker has its own marks, so that batched checks
+//  don't share line->validcount.
+int* sightlines[MAXWORKERS];
+int sightstamps[MAXWORKERS];
+DOOM_THREADLOCAL int sightworker;
+
+// Sight checks between the same two things, in the same
+//  places, between the same planes, give the same answer.
+// Each entry keeps the sectors whose planes it went
+//  between, so a mover only drops the checks through it.
+// SIGHTCACHESIZE is a power of two.
+#define SIGHTCACHESIZE 1024
+#define SIGHTSECTORS 16
+
+typedef struct
+{
+    int epoch;
+    mobj_t* t1;
+    mobj_t* t2;
+    fixed_t x1;
+    fixed_t y1;
+    fixed_t z1;
+    fixed_t height1;
+    fixed_t x2;
+    fixed_t y2;
+    fixed_t z2;
+    fixed_t height2;
+    doom_boolean result;
+    int moves;          // sightmoves when it was made
+    int numsectors;     // past SIGHTSECTORS, any move drops it
+    sector_t* sectors[SIGHTSECTORS];
+} sightcache_t;
 
-divline_t strace; // from t1 to t2
-fixed_t t2x;
-fixed_t t2y;
+sightcache_t sightcache[SIGHTCACHESIZE];
+int sightepoch = 1;
+int sightmoves;
 
-int sightcounts[2];
+// the entry P_SightPath is filling in
+DOOM_THREADLOCAL sightcache_t* sightentry;
+
+// -sightbatch: the checks monsters are about to make are
+//  worked out on the worker threads before the thinkers
+//  run, and left in the sight cache for P_CheckSight.
+doom_boolean sightbatch;
+sightcache_t* sightqueries;
+int numsightqueries;
+int maxsightqueries;
+
+#define SIGHTSLOT(t1, t2, x2, y2) \
+    (((((size_t)(t1) >> 4) * 31 + ((size_t)(t2) >> 4)) * 31 \
+      + (unsigned)((x2) ^ (y2))) & (SIGHTCACHESIZE - 1))
 
 
 //
@@ -33549,6 +35780,46 @@ fixed_t P_InterceptVector2(divline_t* v2, divline_t* v1)
 }
 
 
+//
+// P_SightSector
+// Notes a sector the current check goes between.
+//
+void P_SightSector(sector_t* sector)
+{
+    sightcache_t* entry;
+    int i;
+
+    entry = sightentry;
+
+    for (i = 0; i < entry->numsectors && i < SIGHTSECTORS; i++)
+        if (entry->sectors[i] == sector)
+            return;
+
+    if (entry->numsectors < SIGHTSECTORS)
+        entry->sectors[entry->numsectors] = sector;
+    entry->numsectors++;
+}
+
+
+//
+// P_SightFresh
+// True if no plane the entry went between has moved since.
+//
+doom_boolean P_SightFresh(sightcache_t* entry)
+{
+    int i;
+
+    if (entry->numsectors > SIGHTSECTORS)
+        return entry->moves == sightmoves;
+
+    for (i = 0; i < entry->numsectors; i++)
+        if (entry->sectors[i]->sightmoved > entry->moves)
+            return false;
+
+    return true;
+}
+
+
 //
 // P_CrossSubsector
 // Returns true
@@ -33571,6 +35842,8 @@ doom_boolean P_CrossSubsector(int num)
     vertex_t* v2;
     fixed_t frac;
     fixed_t slope;
+    int* marks;
+    int stamp;
 
 #ifdef RANGECHECK
     if (num >= numsubsectors)
@@ -33588,6 +35861,8 @@ doom_boolean P_CrossSubsector(int num)
 #endif
 
     sub = &subsectors[num];
+    marks = sightlines[sightworker];
+    stamp = sightstamps[sightworker];
 
     // check lines
     count = sub->numlines;
@@ -33598,10 +35873,10 @@ doom_boolean P_CrossSubsector(int num)
         line = seg->linedef;
 
         // allready checked other side?
-        if (line->validcount == validcount)
+        if (marks[line - lines] == stamp)
             continue;
 
-        line->validcount = validcount;
+        marks[line - lines] = stamp;
 
         v1 = line->v1;
         v2 = line->v2;
@@ -33631,6 +35906,8 @@ doom_boolean P_CrossSubsector(int num)
         // crosses a two sided line
         front = seg->frontsector;
         back = seg->backsector;
+        P_SightSector(front);
+        P_SightSector(back);
 
         // no wall to block sight with?
         if (front->floorheight == back->floorheight
@@ -33720,6 +35997,50 @@ doom_boolean P_CrossBSPNode(int bspnum)
 }
 
 
+//
+// P_SightLines
+// Gives a worker its line marks for this level.
+//
+void P_SightLines(int worker)
+{
+    if (sightlines[worker])
+        return;
+
+    Z_Malloc(numlines * sizeof(int), PU_LEVEL, &sightlines[worker]);
+    doom_memset(sightlines[worker], 0, numlines * sizeof(int));
+    sightstamps[worker] = 0;
+}
+
+
+//
+// P_SightPath
+// Looks from the eyes of the first thing in the entry
+//  to any part of the second, from where the entry
+//  says they are. Safe to run on any worker.
+//
+doom_boolean P_SightPath(sightcache_t* entry)
+{
+    sightstamps[sightworker]++;
+    sightentry = entry;
+    entry->moves = sightmoves;
+    entry->numsectors = 0;
+
+    sightzstart = entry->z1 + entry->height1 - (entry->height1 >> 2);
+    topslope = (entry->z2 + entry->height2) - sightzstart;
+    bottomslope = (entry->z2) - sightzstart;
+
+    strace.x = entry->x1;
+    strace.y = entry->y1;
+    t2x = entry->x2;
+    t2y = entry->y2;
+    strace.dx = entry->x2 - entry->x1;
+    strace.dy = entry->y2 - entry->y1;
+
+    // the head node is the last node output
+    return P_CrossBSPNode(numnodes - 1);
+}
+
+
 //
 // P_CheckSight
 // Returns true
@@ -33733,6 +36054,8 @@ doom_boolean P_CheckSight(mobj_t* t1, mobj_t* t2)
     int pnum;
     int bytenum;
     int bitnum;
+    sightcache_t* entry;
+    sightcache_t check;
 
     // First check for trivial rejection.
 
@@ -33752,25 +36075,184 @@ doom_boolean P_CheckSight(mobj_t* t1, mobj_t* t2)
         return false;
     }
 
+    // Checked already this tic? Only worth looking with
+    //  -sightbatch, as otherwise a monster seldom checks
+    //  the same target twice in a tic.
+    entry = &sightcache[SIGHTSLOT(t1, t2, t2->x, t2->y)];
+
+    if (!sightbatch)
+        entry = &check;
+    else if (entry->epoch == sightepoch
+        && entry->t1 == t1 && entry->t2 == t2
+        && entry->x1 == t1->x && entry->y1 == t1->y
+        && entry->z1 == t1->z && entry->height1 == t1->height
+        && entry->x2 == t2->x && entry->y2 == t2->y
+        && entry->z2 == t2->z && entry->height2 == t2->height
+        && P_SightFresh(entry))
+    {
+        sightcounts[2]++;
+        return entry->result;
+    }
+
     // An unobstructed LOS is possible.
     // Now look from eyes of t1 to any part of t2.
     sightcounts[1]++;
 
     validcount++;
+    P_SightLines(0);
+
+    entry->epoch = sightepoch;
+    entry->t1 = t1;
+    entry->t2 = t2;
+    entry->x1 = t1->x;
+    entry->y1 = t1->y;
+    entry->z1 = t1->z;
+    entry->height1 = t1->height;
+    entry->x2 = t2->x;
+    entry->y2 = t2->y;
+    entry->z2 = t2->z;
+    entry->height2 = t2->height;
 
-    sightzstart = t1->z + t1->height - (t1->height >> 2);
-    topslope = (t2->z + t2->height) - sightzstart;
-    bottomslope = (t2->z) - sightzstart;
+    entry->result = P_SightPath(entry);
+    return entry->result;
+}
 
-    strace.x = t1->x;
-    strace.y = t1->y;
-    t2x = t2->x;
-    t2y = t2->y;
-    strace.dx = t2->x - t1->x;
-    strace.dy = t2->y - t1->y;
 
-    // the head node is the last node output
-    return P_CrossBSPNode(numnodes - 1);
+//
+// P_QueueSight
+// Adds a check from t1 to t2, with t2 at x2, y2.
+//
+void P_QueueSight(mobj_t* t1, mobj_t* t2, fixed_t x2, fixed_t y2)
+{
+    sightcache_t* query;
+    int pnum;
+
+    pnum = (int)(t1->subsector->sector - sectors) * numsectors
+        + (int)(t2->subsector->sector - sectors);
+
+    // REJECT is quicker than a worker
+    if (rejectmatrix[pnum >> 3] & (1 << (pnum & 7)))
+        return;
+
+    if (numsightqueries == maxsightqueries)
+    {
+        sightqueries = R_GrowArray(sightqueries, &maxsightqueries,
+                                   sizeof(*sightqueries), 256);
+    }
+
+    query = &sightqueries[numsightqueries++];
+    query->epoch = sightepoch;
+    query->t1 = t1;
+    query->t2 = t2;
+    query->x1 = t1->x;
+    query->y1 = t1->y;
+    query->z1 = t1->z;
+    query->height1 = t1->height;
+    query->x2 = x2;
+    query->y2 = y2;
+    query->z2 = t2->z;
+    query->height2 = t2->height;
+}
+
+
+//
+// P_BatchSightJob
+// Worker job, runs every numworkers'th query.
+//
+void P_BatchSightJob(int worker)
+{
+    int i;
+
+    sightworker = worker;
+
+    for (i = worker; i < numsightqueries; i += numworkers)
+        sightqueries[i].result = P_SightPath(&sightqueries[i]);
+
+    sightworker = 0;
+}
+
+
+//
+// P_BatchSight
+// Called by P_Ticker before the thinkers run.
+// Monsters whose next action is due this tic will
+//  mostly look at their target and the players, so
+//  those checks are made up front, as the world is
+//  now. Players that are moving are also tried where
+//  their momentum will take them. P_CheckSight only
+//  takes an answer whose positions match exactly, and
+//  none through a sector T_MovePlane has moved since,
+//  so the thinkers see the same results in the same
+//  order as without it.
+//
+void P_BatchSight(void)
+{
+    thinker_t* th;
+    mobj_t* mo;
+    mobj_t* other;
+    sightcache_t* query;
+    int i;
+    int j;
+
+    if (!sightbatch || numworkers < 2)
+        return;
+
+    numsightqueries = 0;
+
+    for (i = 0; i < numrunthinkers; i++)
+    {
+        th = runthinkers[i];
+        if (th->function.acp1 != (actionf_p1)P_MobjThinker)
+            continue;
+
+        mo = (mobj_t*)th;
+        if (mo->tics != 1
+            || mo->player
+            || mo->health <= 0
+            || !(mo->flags & MF_SHOOTABLE)
+            || mo->info->seestate == S_NULL)
+        {
+            continue;
+        }
+
+        for (j = -1; j < MAXPLAYERS; j++)
+        {
+            if (j == -1)
+                other = mo->target;
+            else if (playeringame[j] && players[j].mo != mo->target)
+                other = players[j].mo;
+            else
+                continue;
+
+            if (!other || other == mo
+                || !(other->flags & MF_SHOOTABLE)
+                || other->health <= 0)
+            {
+                continue;
+            }
+
+            P_QueueSight(mo, other, other->x, other->y);
+
+            if (other->player && (other->momx || other->momy))
+                P_QueueSight(mo, other, other->x + other->momx, other->y + other->momy);
+        }
+    }
+
+    if (!numsightqueries)
+        return;
+
+    for (i = 0; i < numworkers; i++)
+        P_SightLines(i);
+
+    I_RunWorkers(P_BatchSightJob);
+
+    for (i = 0; i < numsightqueries; i++)
+    {
+        query = &sightqueries[i];
+        sightcache[SIGHTSLOT(query->t1, query->t2, query->x2, query->y2)] = *query;
+    }
+
+    sightcounts[3] += numsightqueries;
 }
 #define MAXANIMS 32
 #define MAXLINEANIMS 64
@@ -34876,7 +37358,7 @@ int EV_DoDonut(line_t* line)
             s3 = s2->lines[i]->backsector;
 
             //        Spawn rising slime
-            floor = Z_Malloc(sizeof(*floor), PU_LEVSPEC, 0);
+            floor = P_AllocThinker(pool_floor);
             P_AddThinker(&floor->thinker);
             s2->specialdata = floor;
             floor->thinker.function.acp1 = (actionf_p1)T_MoveFloor;
@@ -34890,7 +37372,7 @@ int EV_DoDonut(line_t* line)
             floor->floordestheight = s3->floorheight;
 
             //        Spawn lowering donut-hole
-            floor = Z_Malloc(sizeof(*floor), PU_LEVSPEC, 0);
+            floor = P_AllocThinker(pool_floor);
             P_AddThinker(&floor->thinker);
             s1->specialdata = floor;
             floor->thinker.function.acp1 = (actionf_p1)T_MoveFloor;
@@ -35697,7 +38179,7 @@ int leveltime;
 
 //
 // THINKERS
-// All thinkers should be allocated by Z_Malloc
+// All thinkers should be allocated by P_AllocThinker
 // so they can be operated on uniformly.
 // The actual structures will vary in size,
 // but the first element must be thinker_t.
@@ -35706,6 +38188,208 @@ int leveltime;
 // Both the head and tail of the thinker list.
 thinker_t thinkercap;
 
+// The same thinkers in list order, so that P_RunThinkers
+//  walks an array instead of chasing next pointers.
+thinker_t** runthinkers;
+int numrunthinkers;
+int maxrunthinkers;
+
+
+//
+// THINKER POOLS
+// Each type is carved out of PU_LEVEL slabs of
+//  SLABOBJECTS, so spawning and removing things
+//  doesn't go through the zone. Every object has
+//  a POOLHEADER in front of it, holding its type.
+// Slabs are kept for the whole level, even when a
+//  snapshot rewinds the pool to fewer of them, and
+//  are picked up again before any new one is made.
+//
+#define SLABOBJECTS 64
+#define SLABHEADER 8
+#define POOLHEADER 8
+
+pool_t pools[NUMPOOLS];
+
+
+//
+// P_InitPools
+// Called by P_SetupLevel, after Z_FreeTags has
+//  taken the slabs of the last level.
+//
+void P_InitPools(void)
+{
+    static const int sizes[NUMPOOLS] =
+    {
+        sizeof(mobj_t),
+        sizeof(ceiling_t),
+        sizeof(vldoor_t),
+        sizeof(floormove_t),
+        sizeof(plat_t),
+        sizeof(fireflicker_t),
+        sizeof(lightflash_t),
+        sizeof(strobe_t),
+        sizeof(glow_t)
+    };
+    int i;
+
+    doom_memset(pools, 0, sizeof(pools));
+
+    for (i = 0; i < NUMPOOLS; i++)
+        pools[i].size = (sizes[i] + POOLHEADER + 7) & ~7;
+}
+
+
+//
+// P_AllocThinker
+// Like Z_Malloc, the object is not cleared.
+//
+void* P_AllocThinker(pooltype_t type)
+{
+    pool_t* pool;
+    byte* object;
+    byte* next;
+
+    pool = &pools[type];
+
+    if (pool->free)
+    {
+        object = pool->free;
+        pool->free = *(void**)object;
+    }
+    else
+    {
+        if (!pool->slableft)
+        {
+            next = pool->curslab ? *(byte**)pool->curslab : pool->firstslab;
+            if (!next)
+            {
+                next = Z_Malloc(SLABHEADER + SLABOBJECTS * pool->size, PU_LEVEL, 0);
+                *(byte**)next = 0;
+                if (pool->curslab)
+                    *(byte**)pool->curslab = next;
+                else
+                    pool->firstslab = next;
+            }
+
+            pool->curslab = next;
+            pool->slab = next + SLABHEADER;
+            pool->slableft = SLABOBJECTS;
+            pool->slabs++;
+        }
+
+        object = pool->slab + POOLHEADER;
+        *(int*)pool->slab = type;
+        pool->slab += pool->size;
+        pool->slableft--;
+    }
+
+    pool->live++;
+    pool->allocs++;
+    return object;
+}
+
+
+//
+// P_FreeThinker
+// Only the first word is reused for the free list,
+//  so thinker->next still holds for P_RunThinkers.
+//
+void P_FreeThinker(thinker_t* thinker)
+{
+    pool_t* pool;
+
+    pool = &pools[*(int*)((byte*)thinker - POOLHEADER)];
+    *(void**)thinker = pool->free;
+    pool->free = thinker;
+    pool->live--;
+    pool->frees++;
+}
+
+
+//
+// P_PoolsSize
+// Bytes P_ArchivePools will write.
+//
+int P_PoolsSize(void)
+{
+    int size;
+    int i;
+
+    size = 0;
+    for (i = 0; i < NUMPOOLS; i++)
+        size += sizeof(pool_t) + pools[i].slabs * SLABOBJECTS * pools[i].size;
+
+    return size;
+}
+
+
+//
+// P_ArchivePools
+// The slabs in use are written whole, free objects and
+//  all, so they come back exactly as they were.
+// Mobjs go last, as they change the most.
+//
+void P_ArchivePools(void)
+{
+    pool_t* pool;
+    byte* slab;
+    int i;
+    int j;
+
+    for (i = NUMPOOLS - 1; i >= 0; i--)
+    {
+        pool = &pools[i];
+        doom_memcpy(save_p, pool, sizeof(*pool));
+        save_p += sizeof(*pool);
+
+        for (j = 0, slab = pool->firstslab; j < pool->slabs; j++, slab = *(byte**)slab)
+        {
+            doom_memcpy(save_p, slab + SLABHEADER, SLABOBJECTS * pool->size);
+            save_p += SLABOBJECTS * pool->size;
+        }
+    }
+}
+
+
+//
+// P_UnArchivePools
+// Only into the level P_ArchivePools was called in,
+//  which still has all of the slabs it wrote.
+//
+void P_UnArchivePools(void)
+{
+    pool_t saved;
+    pool_t* pool;
+    byte* slab;
+    int i;
+    int j;
+
+    for (i = NUMPOOLS - 1; i >= 0; i--)
+    {
+        pool = &pools[i];
+        doom_memcpy(&saved, save_p, sizeof(saved));
+        save_p += sizeof(saved);
+
+        for (j = 0, slab = pool->firstslab; j < saved.slabs; j++, slab = *(byte**)slab)
+        {
+            if (!slab)
+                I_Error("Error: P_UnArchivePools: slab missing");
+
+            doom_memcpy(slab + SLABHEADER, save_p, SLABOBJECTS * pool->size);
+            save_p += SLABOBJECTS * pool->size;
+        }
+
+        // the slab chain itself is left alone
+        pool->free = saved.free;
+        pool->slab = saved.slab;
+        pool->slableft = saved.slableft;
+        pool->slabs = saved.slabs;
+        pool->curslab = saved.curslab;
+        pool->live = saved.live;
+    }
+}
+
 
 //
 // P_InitThinkers
@@ -35713,6 +38397,7 @@ thinker_t thinkercap;
 void P_InitThinkers(void)
 {
     thinkercap.prev = thinkercap.next = &thinkercap;
+    numrunthinkers = 0;
 }
 
 
@@ -35726,6 +38411,35 @@ void P_AddThinker(thinker_t* thinker)
     thinker->next = &thinkercap;
     thinker->prev = thinkercap.prev;
     thinkercap.prev = thinker;
+
+    if (numrunthinkers == maxrunthinkers)
+    {
+        runthinkers = R_GrowArray(runthinkers, &maxrunthinkers,
+                                  sizeof(*runthinkers), 1024);
+    }
+    runthinkers[numrunthinkers++] = thinker;
+}
+
+
+//
+// P_RelinkThinkers
+// Fills runthinkers back in from the list,
+//  after P_UnArchiveSnapshot has put it back.
+//
+void P_RelinkThinkers(void)
+{
+    thinker_t* th;
+
+    numrunthinkers = 0;
+    for (th = thinkercap.next; th != &thinkercap; th = th->next)
+    {
+        if (numrunthinkers == maxrunthinkers)
+        {
+            runthinkers = R_GrowArray(runthinkers, &maxrunthinkers,
+                                      sizeof(*runthinkers), 1024);
+        }
+        runthinkers[numrunthinkers++] = th;
+    }
 }
 
 
@@ -35743,28 +38457,41 @@ void P_RemoveThinker(thinker_t* thinker)
 
 //
 // P_RunThinkers
+// Runs the thinkers in list order, which demos depend on.
+// Thinkers added on the way are run in the same tic,
+//  and removed ones are squeezed out of runthinkers.
 //
 void P_RunThinkers(void)
 {
     thinker_t* currentthinker;
+    int i;
+    int kept;
 
-    currentthinker = thinkercap.next;
-    while (currentthinker != &thinkercap)
+    kept = 0;
+
+    for (i = 0; i < numrunthinkers; i++)
     {
+        currentthinker = runthinkers[i];
+
+        if (i + 2 < numrunthinkers)
+            DOOM_PREFETCH(runthinkers[i + 2]);
+
         if (currentthinker->function.acv == (actionf_v)(-1))
         {
             // time to remove it
             currentthinker->next->prev = currentthinker->prev;
             currentthinker->prev->next = currentthinker->next;
-            Z_Free(currentthinker);
-        }
-        else
-        {
-            if (currentthinker->function.acp1)
-                currentthinker->function.acp1(currentthinker);
+            P_FreeThinker(currentthinker);
+            continue;
         }
-        currentthinker = currentthinker->next;
+
+        if (currentthinker->function.acp1)
+            currentthinker->function.acp1(currentthinker);
+
+        runthinkers[kept++] = currentthinker;
     }
+
+    numrunthinkers = kept;
 }
 
 
@@ -35788,10 +38515,16 @@ void P_Ticker(void)
         return;
     }
 
+    for (i = 0; i < NUMPOOLS; i++)
+        pools[i].allocs = pools[i].frees = 0;
+
+    sightepoch++;
+
     for (i = 0; i < MAXPLAYERS; i++)
         if (playeringame[i])
             P_PlayerThink(&players[i]);
 
+    P_BatchSight();
     P_RunThinkers();
     P_UpdateSpecials();
     P_RespawnSpecials();
@@ -36149,14 +38882,16 @@ typedef struct
 } cliprange_t;
 
 
-seg_t* curline;
+DOOM_THREADLOCAL seg_t* curline;
 side_t* sidedef;
 line_t* linedef;
-sector_t* frontsector;
-sector_t* backsector;
+DOOM_THREADLOCAL sector_t* frontsector;
+DOOM_THREADLOCAL sector_t* backsector;
 
-drawseg_t drawsegs[MAXDRAWSEGS];
+drawseg_t* drawsegs;
 drawseg_t* ds_p;
+int maxdrawsegs;
+int peakdrawsegs;
 
 // newend is one past the last valid seg
 cliprange_t* newend;
@@ -36910,6 +39645,8 @@ void R_GenerateComposite(int texnum)
 
 //
 // R_GenerateLookup
+// Called by R_GetColumn the first time a texture
+//  is drawn, rather than for every texture at startup.
 //
 void R_GenerateLookup(int texnum)
 {
@@ -36930,8 +39667,10 @@ void R_GenerateLookup(int texnum)
     texturecomposite[texnum] = 0;
 
     texturecompositesize[texnum] = 0;
-    collump = texturecolumnlump[texnum];
-    colofs = texturecolumnofs[texnum];
+    collump = texturecolumnlump[texnum] =
+        Z_Malloc(texture->width * sizeof(short), PU_STATIC, 0);
+    colofs = texturecolumnofs[texnum] =
+        Z_Malloc(texture->width * sizeof(unsigned short), PU_STATIC, 0);
 
     // Now count the number of columns
     //  that are covered by more than one patch.
@@ -37010,6 +39749,9 @@ byte* R_GetColumn(int tex, int col)
     int lump;
     int ofs;
 
+    if (!texturecolumnlump[tex])
+        R_GenerateLookup(tex);
+
     col &= texturewidthmask[tex];
     lump = texturecolumnlump[tex][col];
     ofs = texturecolumnofs[tex][col];
@@ -37018,7 +39760,14 @@ byte* R_GetColumn(int tex, int col)
         return (byte*)W_CacheLumpNum(lump, PU_CACHE) + ofs;
 
     if (!texturecomposite[tex])
+    {
+        if (precachetextures && precachetextures[tex])
+        {
+            precachestalls++;
+            precachetextures[tex] = 0;
+        }
         R_GenerateComposite(tex);
+    }
 
     return texturecomposite[tex] + ofs;
 }
@@ -37169,8 +39918,10 @@ void R_InitTextures(void)
                 I_Error(error_buf);
             }
         }
-        texturecolumnlump[i] = Z_Malloc(texture->width * sizeof(short), PU_STATIC, 0);
-        texturecolumnofs[i] = Z_Malloc(texture->width * sizeof(unsigned short), PU_STATIC, 0);
+        // column lookups are made on first use
+        texturecolumnlump[i] = 0;
+        texturecolumnofs[i] = 0;
+        texturecomposite[i] = 0;
 
         j = 1;
         while (j * 2 <= texture->width)
@@ -37186,10 +39937,6 @@ void R_InitTextures(void)
     if (maptex2)
         Z_Free(maptex2);
 
-    // Precalculate whatever possible.        
-    for (i = 0; i < numtextures; i++)
-        R_GenerateLookup(i);
-
     // Create translation table for global animation.
     texturetranslation = Z_Malloc((numtextures + 1) * sizeof(int), PU_STATIC, 0);
 
@@ -37268,6 +40015,338 @@ void R_InitColormaps(void)
 }
 
 
+//
+// STARTUP CACHE
+// Everything R_GenerateLookup and R_InitSpriteDefs work
+//  out only depends on the WAD files loaded, so with
+//  -startcache it is saved once and mapped back in on
+//  the next start. The file is in native byte order:
+//  a startcache_t, then for each texture its composite
+//  size, width and column lumps and offsets, then for
+//  each sprite its frame count and frames.
+//
+#define STARTCACHEMAGIC 0x31434450 // "PDC1"
+#define STARTCACHEVERSION 3
+
+typedef struct
+{
+    int magic;
+    int version;
+    unsigned stamp;
+    unsigned key;
+    int numtextures;
+    int numsprites;
+    int size;
+} startcache_t;
+
+char* startcachename;
+byte* startcache;
+int startcachesize;
+byte* startcachesprites;
+
+// R_StartupCacheKey reads every WAD file, so only once
+doom_boolean startcachekeyed;
+unsigned startcachekey;
+
+
+//
+// R_HashBytes
+// FNV-1a, carried on from key.
+//
+unsigned R_HashBytes(unsigned key, void* data, int count)
+{
+    byte* p;
+    int i;
+
+    for (p = data, i = 0; i < count; i++)
+        key = (key ^ p[i]) * 16777619u;
+
+    return key;
+}
+
+
+//
+// R_HashFile
+// The whole contents of a file, or just its name
+//  if it can't be opened.
+//
+unsigned R_HashFile(unsigned key, char* filename)
+{
+    void* handle;
+    byte* buffer;
+    int count;
+
+    key = R_HashBytes(key, filename, doom_strlen(filename));
+
+    handle = doom_open(filename, "rb");
+    if (!handle)
+        return key;
+
+    buffer = doom_malloc(65536);
+
+    while ((count = doom_read(handle, buffer, 65536)) > 0)
+        key = R_HashBytes(key, buffer, count);
+
+    doom_free(buffer);
+    doom_close(handle);
+
+    return key;
+}
+
+
+//
+// R_StartupCacheWords
+// The lump directory, and whatever else changes
+//  the derived data that is not in the WAD files.
+//
+unsigned R_StartupCacheWords(void)
+{
+    unsigned key;
+    int i;
+    int words[5];
+
+    words[0] = numlumps;
+    words[1] = numtextures;
+    words[2] = NUMSPRITES;
+    words[3] = modifiedgame;
+    words[4] = sizeof(spriteframe_t);
+
+    key = R_HashBytes(2166136261u, words, sizeof(words));
+
+    for (i = 0; i < numlumps; i++)
+    {
+        key = R_HashBytes(key, lumpinfo[i].name, 8);
+
+        words[0] = lumpinfo[i].position;
+        words[1] = lumpinfo[i].size;
+        key = R_HashBytes(key, words, 2 * sizeof(int));
+    }
+
+    return key;
+}
+
+
+//
+// R_StartupCacheStamp
+// Adds the path, size and modification time of each
+//  WAD file. Cheap, so it is checked first; only a
+//  cache with a different stamp needs the key.
+//
+unsigned R_StartupCacheStamp(void)
+{
+    unsigned key;
+    char* name;
+    long long stamp[2];
+    int i;
+
+    key = R_StartupCacheWords();
+
+    for (i = 0; i < MAXWADFILES && wadfiles[i]; i++)
+    {
+        name = wadfiles[i][0] == '~' ? wadfiles[i] + 1 : wadfiles[i];
+        key = R_HashBytes(key, name, doom_strlen(name));
+
+        if (!W_FileStamp(name, &stamp[0], &stamp[1]))
+            stamp[0] = stamp[1] = -1;
+        key = R_HashBytes(key, stamp, sizeof(stamp));
+    }
+
+    return key;
+}
+
+
+//
+// R_StartupCacheKey
+// Adds the contents of each WAD file, so a rebuilt
+//  PWAD that only edits lumps in place still gets
+//  a new key, and one that was only touched does not.
+//
+unsigned R_StartupCacheKey(void)
+{
+    char* name;
+    int i;
+
+    if (startcachekeyed)
+        return startcachekey;
+
+    startcachekey = R_StartupCacheWords();
+
+    for (i = 0; i < MAXWADFILES && wadfiles[i]; i++)
+    {
+        name = wadfiles[i][0] == '~' ? wadfiles[i] + 1 : wadfiles[i];
+        startcachekey = R_HashFile(startcachekey, name);
+    }
+
+    startcachekeyed = true;
+    return startcachekey;
+}
+
+
+//
+// R_LoadStartupCache
+// Called after R_InitTextures. Maps the cache and points
+//  the texture lookups into it, and R_InitSpriteDefs
+//  at the sprite frames. Leaves startcache at 0 if there
+//  is no usable cache, so that it gets rebuilt.
+//
+void R_LoadStartupCache(void)
+{
+    startcache_t* header;
+    byte* data;
+    byte* end;
+    int width;
+    int numframes;
+    int i;
+    int p;
+
+    p = M_CheckParm("-startcache");
+    if (!p || p >= myargc - 1)
+        return;
+
+    startcachename = myargv[p + 1];
+    startcache = W_MapFile(startcachename, &startcachesize);
+
+    if (!startcache)
+        return;
+
+    header = (startcache_t*)startcache;
+    end = startcache + startcachesize;
+    data = startcache + sizeof(*header);
+
+    if (startcachesize < (int)sizeof(*header)
+        || header->magic != STARTCACHEMAGIC
+        || header->version != STARTCACHEVERSION
+        || (header->stamp != R_StartupCacheStamp()
+            && header->key != R_StartupCacheKey())
+        || header->numtextures != numtextures
+        || header->numsprites != NUMSPRITES
+        || header->size != startcachesize)
+    {
+        data = 0;
+    }
+
+    // check the sizes before using any of it
+    for (i = 0; data && i < numtextures; i++)
+    {
+        width = end - data < 8 ? -1 : ((int*)data)[1];
+
+        if (width != textures[i]->width || end - data < 8 + width * 4)
+            data = 0;
+        else
+            data += 8 + width * 4;
+    }
+
+    startcachesprites = data;
+
+    for (i = 0; data && i < NUMSPRITES; i++)
+    {
+        numframes = end - data < 4 ? -1 : *(int*)data;
+
+        if (numframes < 0
+            || numframes > 29
+            || end - data < 4 + numframes * (int)sizeof(spriteframe_t))
+        {
+            data = 0;
+        }
+        else
+            data += 4 + numframes * sizeof(spriteframe_t);
+    }
+
+    if (data != end)
+    {
+        doom_print("\nR_LoadStartupCache: rebuilding ");
+        doom_print(startcachename);
+        W_UnmapFile(startcache, startcachesize);
+        startcache = 0;
+        startcachesprites = 0;
+        return;
+    }
+
+    data = startcache + sizeof(*header);
+
+    for (i = 0; i < numtextures; i++)
+    {
+        width = ((int*)data)[1];
+        texturecompositesize[i] = ((int*)data)[0];
+        texturecolumnlump[i] = (short*)(data + 8);
+        texturecolumnofs[i] = (unsigned short*)(data + 8 + width * 2);
+        data += 8 + width * 4;
+    }
+}
+
+
+//
+// R_SaveStartupCache
+//
+void R_SaveStartupCache(void)
+{
+    startcache_t* header;
+    byte* buffer;
+    byte* p;
+    int size;
+    int width;
+    int i;
+
+    if (!startcachename || startcache)
+        return;
+
+    size = sizeof(*header);
+
+    for (i = 0; i < numtextures; i++)
+    {
+        // the cache has every lookup, not just the ones used so far
+        if (!texturecolumnlump[i])
+            R_GenerateLookup(i);
+        size += 8 + textures[i]->width * 4;
+    }
+
+    for (i = 0; i < numsprites; i++)
+        size += 4 + sprites[i].numframes * sizeof(spriteframe_t);
+
+    buffer = doom_malloc(size);
+    if (!buffer)
+        return;
+
+    header = (startcache_t*)buffer;
+    header->magic = STARTCACHEMAGIC;
+    header->version = STARTCACHEVERSION;
+    header->stamp = R_StartupCacheStamp();
+    header->key = R_StartupCacheKey();
+    header->numtextures = numtextures;
+    header->numsprites = numsprites;
+    header->size = size;
+
+    p = buffer + sizeof(*header);
+
+    for (i = 0; i < numtextures; i++)
+    {
+        width = textures[i]->width;
+        ((int*)p)[0] = texturecompositesize[i];
+        ((int*)p)[1] = width;
+        doom_memcpy(p + 8, texturecolumnlump[i], width * 2);
+        doom_memcpy(p + 8 + width * 2, texturecolumnofs[i], width * 2);
+        p += 8 + width * 4;
+    }
+
+    for (i = 0; i < numsprites; i++)
+    {
+        *(int*)p = sprites[i].numframes;
+        doom_memcpy(p + 4, sprites[i].spriteframes,
+                    sprites[i].numframes * sizeof(spriteframe_t));
+        p += 4 + sprites[i].numframes * sizeof(spriteframe_t);
+    }
+
+    if (!M_WriteFile(startcachename, buffer, size))
+    {
+        doom_print("R_SaveStartupCache: couldn't write ");
+        doom_print(startcachename);
+        doom_print("\n");
+    }
+
+    doom_free(buffer);
+}
+
+
 //
 // R_InitData
 // Locates all the lumps
@@ -37276,7 +40355,10 @@ void R_InitColormaps(void)
 //
 void R_InitData(void)
 {
+    asyncprecache = M_CheckParm("-asyncprecache");
+
     R_InitTextures();
+    R_LoadStartupCache();
     doom_print("\nInitTextures");
     R_InitFlats();
     doom_print("\nInitFlats");
@@ -37359,6 +40441,263 @@ int R_TextureNumForName(char* name)
 }
 
 
+//
+// PRECACHE QUEUE
+// With -asyncprecache the level starts right away.
+// What can be seen from the player start goes first,
+//  then everything else in the level.
+//
+#define PRECACHEUSEC 2000
+
+doom_boolean asyncprecache;
+int* precachequeue; // lump numbers, or -1 - texture number
+int precachecount;
+int precachenext;
+byte* precachelumps;
+byte* precachetextures;
+int precachestalls;
+volatile doom_boolean precachecancel;
+volatile int precachetouch;
+
+
+//
+// R_ClearPrecache
+// Stops the loader and drops whatever is still queued.
+//
+void R_ClearPrecache(void)
+{
+    precachecancel = true;
+    I_WaitLoader();
+    precachecancel = false;
+
+    if (precachequeue)
+    {
+        doom_free(precachequeue);
+        doom_free(precachelumps);
+        doom_free(precachetextures);
+    }
+
+    precachequeue = 0;
+    precachelumps = 0;
+    precachetextures = 0;
+    precachecount = 0;
+    precachenext = 0;
+    precachestalls = 0;
+}
+
+
+//
+// R_QueueLump
+//
+void R_QueueLump(int lump)
+{
+    if (precachelumps[lump])
+        return;
+
+    precachelumps[lump] = 1;
+    precachequeue[precachecount++] = lump;
+}
+
+
+//
+// R_QueueTexture
+// The patches go first, so that the composite
+//  can be built straight from the cache.
+//
+void R_QueueTexture(int texnum)
+{
+    texture_t* texture;
+    int i;
+
+    if (precachetextures[texnum])
+        return;
+
+    texture = textures[texnum];
+
+    for (i = 0; i < texture->patchcount; i++)
+        R_QueueLump(texture->patches[i].patch);
+
+    precachetextures[texnum] = 1;
+    precachequeue[precachecount++] = -1 - texnum;
+}
+
+
+//
+// R_QueueSprite
+//
+void R_QueueSprite(int spritenum)
+{
+    spriteframe_t* sf;
+    int i;
+    int j;
+
+    for (i = 0; i < sprites[spritenum].numframes; i++)
+    {
+        sf = &sprites[spritenum].spriteframes[i];
+        for (j = 0; j < 8; j++)
+            R_QueueLump(firstspritelump + sf->lump[j]);
+    }
+}
+
+
+//
+// R_QueueLevel
+// Queues the graphics of the level, either only those
+//  in sectors the REJECT table says can be seen from
+//  sector start, or all of them when start is -1.
+//
+void R_QueueLevel(int start)
+{
+    thinker_t* th;
+    sector_t* sector;
+    side_t* side;
+    int i;
+    int pnum;
+
+    for (i = 0, sector = sectors; i < numsectors; i++, sector++)
+    {
+        pnum = start * numsectors + i;
+        if (start != -1 && rejectmatrix[pnum >> 3] & (1 << (pnum & 7)))
+            continue;
+
+        R_QueueLump(firstflat + sector->floorpic);
+        R_QueueLump(firstflat + sector->ceilingpic);
+    }
+
+    for (i = 0, side = sides; i < numsides; i++, side++)
+    {
+        pnum = start * numsectors + (int)(side->sector - sectors);
+        if (start != -1 && rejectmatrix[pnum >> 3] & (1 << (pnum & 7)))
+            continue;
+
+        R_QueueTexture(side->toptexture);
+        R_QueueTexture(side->midtexture);
+        R_QueueTexture(side->bottomtexture);
+    }
+
+    for (th = thinkercap.next; th != &thinkercap; th = th->next)
+    {
+        if (th->function.acp1 != (actionf_p1)P_MobjThinker)
+            continue;
+
+        pnum = start * numsectors
+            + (int)(((mobj_t*)th)->subsector->sector - sectors);
+        if (start != -1 && rejectmatrix[pnum >> 3] & (1 << (pnum & 7)))
+            continue;
+
+        R_QueueSprite(((mobj_t*)th)->sprite);
+    }
+}
+
+
+//
+// R_PrefetchMapped
+// Loader job, faults in the pages of mapped lumps
+//  ahead of R_PrecacheStep. It only reads the queue
+//  and the mapping, never the zone.
+//
+void R_PrefetchMapped(void)
+{
+    byte* data;
+    int lump;
+    int i;
+    int j;
+
+    for (i = 0; i < precachecount && !precachecancel; i++)
+    {
+        lump = precachequeue[i];
+        if (lump < 0 || !lumpinfo[lump].data)
+            continue;
+
+        data = lumpinfo[lump].data;
+        for (j = 0; j < lumpinfo[lump].size; j += 4096)
+            precachetouch += data[j];
+    }
+}
+
+
+//
+// R_QueuePrecache
+//
+void R_QueuePrecache(void)
+{
+    mobj_t* mo;
+
+    precachequeue = doom_malloc((numlumps + numtextures) * sizeof(*precachequeue));
+    precachelumps = doom_malloc(numlumps);
+    precachetextures = doom_malloc(numtextures);
+
+    if (!precachequeue || !precachelumps || !precachetextures)
+        I_Error("Error: R_QueuePrecache: out of memory");
+
+    doom_memset(precachelumps, 0, numlumps);
+    doom_memset(precachetextures, 0, numtextures);
+
+    // Sky texture is always present.
+    R_QueueTexture(skytexture);
+
+    mo = players[consoleplayer].mo;
+    if (mo)
+        R_QueueLevel((int)(mo->subsector->sector - sectors));
+    R_QueueLevel(-1);
+
+    if (wadmapping)
+        I_StartLoader(R_PrefetchMapped);
+}
+
+
+//
+// R_PrecacheStep
+// Works through the queue for up to PRECACHEUSEC.
+//
+void R_PrecacheStep(void)
+{
+    int entry;
+    int texnum;
+    int sec;
+    int usec;
+    int startsec;
+    int startusec;
+
+    if (precachenext >= precachecount)
+        return;
+
+    doom_gettime(&startsec, &startusec);
+
+    do
+    {
+        entry = precachequeue[precachenext++];
+
+        if (entry >= 0)
+        {
+            precachelumps[entry] = 0;
+            W_CacheLumpNum(entry, PU_CACHE);
+        }
+        else
+        {
+            texnum = -1 - entry;
+            precachetextures[texnum] = 0;
+
+            if (!texturecolumnlump[texnum])
+                R_GenerateLookup(texnum);
+            if (texturecompositesize[texnum] && !texturecomposite[texnum])
+                R_GenerateComposite(texnum);
+        }
+
+        doom_gettime(&sec, &usec);
+    } while (precachenext < precachecount
+             && (sec - startsec) * 1000000 + usec - startusec < PRECACHEUSEC);
+
+    if (precachenext == precachecount)
+    {
+        //doom_print("R_PrecacheStep: level cached, %i stalls\n", precachestalls);
+        doom_print("R_PrecacheStep: level cached, ");
+        doom_print(doom_itoa(precachestalls, 10));
+        doom_print(" stalls\n");
+    }
+}
+
+
 //
 // R_PrecacheLevel
 // Preloads all relevant graphics for the level.
@@ -37381,6 +40720,12 @@ void R_PrecacheLevel(void)
     if (demoplayback)
         return;
 
+    if (asyncprecache)
+    {
+        R_QueuePrecache();
+        return;
+    }
+
     // Precache flats.
     flatpresent = doom_malloc(numflats);
     doom_memset(flatpresent, 0, numflats);
@@ -37436,6 +40781,10 @@ void R_PrecacheLevel(void)
             texturememory += lumpinfo[lump].size;
             W_CacheLumpNum(lump, PU_CACHE);
         }
+
+        // saves R_GetColumn doing it in the first frame
+        if (!texturecolumnlump[i])
+            R_GenerateLookup(i);
     }
 
     // Precache sprites.
@@ -37508,15 +40857,15 @@ byte translations[3][256];
 // R_DrawColumn
 // Source is the top of the column to scale.
 //
-lighttable_t* dc_colormap;
-int dc_x;
-int dc_yl;
-int dc_yh;
-fixed_t dc_iscale;
-fixed_t dc_texturemid;
+DOOM_THREADLOCAL lighttable_t* dc_colormap;
+DOOM_THREADLOCAL int dc_x;
+DOOM_THREADLOCAL int dc_yl;
+DOOM_THREADLOCAL int dc_yh;
+DOOM_THREADLOCAL fixed_t dc_iscale;
+DOOM_THREADLOCAL fixed_t dc_texturemid;
 
 // first pixel in a column (possibly virtual) 
-byte* dc_source;
+DOOM_THREADLOCAL byte* dc_source;
 
 // just for profiling 
 int dccount;
@@ -37534,9 +40883,12 @@ int fuzzoffset[FUZZTABLE] =
 
 int fuzzpos = 0;
 
-byte* dc_translation;
+DOOM_THREADLOCAL byte* dc_translation;
 byte* translationtables;
 
+void (*drawcolumnfunc) (void) = R_DrawColumn;
+void (*drawspanfunc) (void) = R_DrawSpan;
+
 
 //
 // A column is a vertical slice/span from a wall texture that,
@@ -37839,19 +41191,19 @@ void R_InitTranslationTables(void)
 // In consequence, flats are not stored by column (like walls),
 // and the inner loop has to step in texture space u and v.
 //
-int ds_y;
-int ds_x1;
-int ds_x2;
+DOOM_THREADLOCAL int ds_y;
+DOOM_THREADLOCAL int ds_x1;
+DOOM_THREADLOCAL int ds_x2;
 
-lighttable_t* ds_colormap;
+DOOM_THREADLOCAL lighttable_t* ds_colormap;
 
-fixed_t ds_xfrac;
-fixed_t ds_yfrac;
-fixed_t ds_xstep;
-fixed_t ds_ystep;
+DOOM_THREADLOCAL fixed_t ds_xfrac;
+DOOM_THREADLOCAL fixed_t ds_yfrac;
+DOOM_THREADLOCAL fixed_t ds_xstep;
+DOOM_THREADLOCAL fixed_t ds_ystep;
 
 // start of a 64*64 tile image 
-byte* ds_source;
+DOOM_THREADLOCAL byte* ds_source;
 
 // just for profiling
 int dscount;
@@ -37967,6 +41319,299 @@ void R_DrawSpanLow(void)
 }
 
 
+//
+// R_DrawColumnBatched
+// R_DrawColumn four pixels at a time, so the
+//  texel and colormap loads can overlap.
+//
+void R_DrawColumnBatched(void)
+{
+    int count;
+    byte* dest;
+    byte* source;
+    lighttable_t* colormap;
+    fixed_t frac;
+    fixed_t fracstep;
+
+    count = dc_yh - dc_yl + 1;
+
+    if (count <= 0)
+        return;
+
+#ifdef RANGECHECK 
+    if ((unsigned)dc_x >= SCREENWIDTH
+        || dc_yl < 0
+        || dc_yh >= SCREENHEIGHT)
+    {
+        doom_strcpy(error_buf, "Error: R_DrawColumnBatched: ");
+        doom_concat(error_buf, doom_itoa(dc_yl, 10));
+        doom_concat(error_buf, " to ");
+        doom_concat(error_buf, doom_itoa(dc_yh, 10));
+        doom_concat(error_buf, " at ");
+        doom_concat(error_buf, doom_itoa(dc_x, 10));
+        I_Error(error_buf);
+    }
+#endif 
+
+    dest = ylookup[dc_yl] + columnofs[dc_x];
+    source = dc_source;
+    colormap = dc_colormap;
+
+    fracstep = dc_iscale;
+    frac = dc_texturemid + (dc_yl - centery) * fracstep;
+
+    while (count >= 4)
+    {
+        dest[0] = colormap[source[(frac >> FRACBITS) & 127]];
+        dest[SCREENWIDTH] = colormap[source[((frac + fracstep) >> FRACBITS) & 127]];
+        dest[SCREENWIDTH * 2] = colormap[source[((frac + fracstep * 2) >> FRACBITS) & 127]];
+        dest[SCREENWIDTH * 3] = colormap[source[((frac + fracstep * 3) >> FRACBITS) & 127]];
+
+        dest += SCREENWIDTH * 4;
+        frac += fracstep * 4;
+        count -= 4;
+    }
+
+    while (count--)
+    {
+        *dest = colormap[source[(frac >> FRACBITS) & 127]];
+        dest += SCREENWIDTH;
+        frac += fracstep;
+    }
+}
+
+
+//
+// R_DrawSpanBatched
+// R_DrawSpan four pixels at a time.
+//
+void R_DrawSpanBatched(void)
+{
+    fixed_t xfrac;
+    fixed_t yfrac;
+    fixed_t xstep;
+    fixed_t ystep;
+    byte* dest;
+    byte* source;
+    lighttable_t* colormap;
+    int count;
+
+#ifdef RANGECHECK 
+    if (ds_x2 < ds_x1
+        || ds_x1<0
+        || ds_x2 >= SCREENWIDTH
+        || (unsigned)ds_y>SCREENHEIGHT)
+    {
+        doom_strcpy(error_buf, "Error: R_DrawSpanBatched: ");
+        doom_concat(error_buf, doom_itoa(ds_x1, 10));
+        doom_concat(error_buf, " to ");
+        doom_concat(error_buf, doom_itoa(ds_x2, 10));
+        doom_concat(error_buf, " at ");
+        doom_concat(error_buf, doom_itoa(ds_y, 10));
+        I_Error(error_buf);
+    }
+#endif 
+
+    xfrac = ds_xfrac;
+    yfrac = ds_yfrac;
+    xstep = ds_xstep;
+    ystep = ds_ystep;
+    source = ds_source;
+    colormap = ds_colormap;
+
+    dest = ylookup[ds_y] + columnofs[ds_x1];
+    count = ds_x2 - ds_x1 + 1;
+
+#define SPANSPOT(xf, yf) ((((yf) >> (16 - 6)) & (63 * 64)) + (((xf) >> 16) & 63))
+
+    while (count >= 4)
+    {
+        dest[0] = colormap[source[SPANSPOT(xfrac, yfrac)]];
+        dest[1] = colormap[source[SPANSPOT(xfrac + xstep, yfrac + ystep)]];
+        dest[2] = colormap[source[SPANSPOT(xfrac + xstep * 2, yfrac + ystep * 2)]];
+        dest[3] = colormap[source[SPANSPOT(xfrac + xstep * 3, yfrac + ystep * 3)]];
+
+        dest += 4;
+        xfrac += xstep * 4;
+        yfrac += ystep * 4;
+        count -= 4;
+    }
+
+    while (count--)
+    {
+        *dest++ = colormap[source[SPANSPOT(xfrac, yfrac)]];
+        xfrac += xstep;
+        yfrac += ystep;
+    }
+
+#undef SPANSPOT
+}
+
+
+#if defined(DOOM_AVX2)
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define DOOM_TARGET_AVX2
+#else
+#define DOOM_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#include <immintrin.h>
+
+
+//
+// R_DrawSpanAVX2
+// R_DrawSpan eight pixels at a time, with gathers for the
+//  flat and colormap lookups. The gathers load the dword
+//  that ends on the wanted byte, so they never read past
+//  the end of the flat; the bytes before it are always
+//  there (a zone block header, or the WAD file's own
+//  header when it is mapped).
+//
+DOOM_TARGET_AVX2 void R_DrawSpanAVX2(void)
+{
+    fixed_t xfrac;
+    fixed_t yfrac;
+    byte* dest;
+    int count;
+    int spot;
+    __m256i lanes;
+    __m256i xf;
+    __m256i yf;
+    __m256i xstep8;
+    __m256i ystep8;
+    __m256i spots;
+    __m256i pixels;
+    __m128i lo;
+    __m128i hi;
+
+#ifdef RANGECHECK 
+    if (ds_x2 < ds_x1
+        || ds_x1<0
+        || ds_x2 >= SCREENWIDTH
+        || (unsigned)ds_y>SCREENHEIGHT)
+    {
+        doom_strcpy(error_buf, "Error: R_DrawSpanAVX2: ");
+        doom_concat(error_buf, doom_itoa(ds_x1, 10));
+        doom_concat(error_buf, " to ");
+        doom_concat(error_buf, doom_itoa(ds_x2, 10));
+        doom_concat(error_buf, " at ");
+        doom_concat(error_buf, doom_itoa(ds_y, 10));
+        I_Error(error_buf);
+    }
+#endif 
+
+    xfrac = ds_xfrac;
+    yfrac = ds_yfrac;
+
+    dest = ylookup[ds_y] + columnofs[ds_x1];
+    count = ds_x2 - ds_x1 + 1;
+
+    if (count >= 8)
+    {
+        lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+        xf = _mm256_add_epi32(_mm256_set1_epi32(xfrac),
+                              _mm256_mullo_epi32(lanes, _mm256_set1_epi32(ds_xstep)));
+        yf = _mm256_add_epi32(_mm256_set1_epi32(yfrac),
+                              _mm256_mullo_epi32(lanes, _mm256_set1_epi32(ds_ystep)));
+        xstep8 = _mm256_slli_epi32(_mm256_set1_epi32(ds_xstep), 3);
+        ystep8 = _mm256_slli_epi32(_mm256_set1_epi32(ds_ystep), 3);
+
+        do
+        {
+            spots = _mm256_add_epi32(
+                _mm256_and_si256(_mm256_srli_epi32(yf, 16 - 6), _mm256_set1_epi32(63 * 64)),
+                _mm256_and_si256(_mm256_srli_epi32(xf, 16), _mm256_set1_epi32(63)));
+
+            pixels = _mm256_i32gather_epi32((const int*)(ds_source - 3), spots, 1);
+            pixels = _mm256_srli_epi32(pixels, 24);
+            pixels = _mm256_i32gather_epi32((const int*)(ds_colormap - 3), pixels, 1);
+            pixels = _mm256_srli_epi32(pixels, 24);
+
+            // Eight dwords down to eight bytes.
+            pixels = _mm256_packus_epi32(pixels, pixels);
+            pixels = _mm256_packus_epi16(pixels, pixels);
+            lo = _mm256_castsi256_si128(pixels);
+            hi = _mm256_extracti128_si256(pixels, 1);
+            _mm_storel_epi64((__m128i*)dest, _mm_unpacklo_epi32(lo, hi));
+
+            xf = _mm256_add_epi32(xf, xstep8);
+            yf = _mm256_add_epi32(yf, ystep8);
+            dest += 8;
+            count -= 8;
+        } while (count >= 8);
+
+        xfrac = _mm256_extract_epi32(xf, 0);
+        yfrac = _mm256_extract_epi32(yf, 0);
+    }
+
+    while (count--)
+    {
+        spot = ((yfrac >> (16 - 6)) & (63 * 64)) + ((xfrac >> 16) & 63);
+        *dest++ = ds_colormap[ds_source[spot]];
+        xfrac += ds_xstep;
+        yfrac += ds_ystep;
+    }
+}
+
+
+static doom_boolean R_HasAVX2(void)
+{
+#if defined(_MSC_VER)
+    int info[4];
+
+    __cpuid(info, 0);
+    if (info[0] < 7)
+        return false;
+
+    // AVX, and the OS saves the ymm registers
+    __cpuid(info, 1);
+    if ((info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0)
+        return false;
+    if ((_xgetbv(0) & 6) != 6)
+        return false;
+
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") != 0;
+#endif
+}
+
+#endif
+
+
+//
+// R_InitDrawers
+// Picks the high detail column and span drawers:
+//  the batched ones, unless -drawers asks for the
+//  reference ("ref") or gather ("avx2") versions.
+// The gathers are not faster on every CPU that has
+//  them, so they are never picked by default.
+//
+void R_InitDrawers(void)
+{
+    int p;
+
+    drawcolumnfunc = R_DrawColumnBatched;
+    drawspanfunc = R_DrawSpanBatched;
+
+    p = M_CheckParm("-drawers");
+    if (!p || p >= myargc - 1)
+        return;
+
+    if (!doom_strcasecmp(myargv[p + 1], "ref"))
+    {
+        drawcolumnfunc = R_DrawColumn;
+        drawspanfunc = R_DrawSpan;
+    }
+#if defined(DOOM_AVX2)
+    else if (!doom_strcasecmp(myargv[p + 1], "avx2") && R_HasAVX2())
+        drawspanfunc = R_DrawSpanAVX2;
+#endif
+}
+
 //
 // R_InitBuffer 
 // Creats lookup tables that avoid
@@ -38211,12 +41856,12 @@ int setblocks;
 int setdetail;
 
 
-extern lighttable_t** walllights;
+extern DOOM_THREADLOCAL lighttable_t** walllights;
 extern int detailLevel;
 extern int screenblocks;
 
 
-void (*colfunc) (void);
+DOOM_THREADLOCAL void (*colfunc) (void);
 void (*basecolfunc) (void);
 void (*fuzzcolfunc) (void);
 void (*transcolfunc) (void);
@@ -38241,6 +41886,34 @@ void R_AddPointToBox(int x, int y, fixed_t* box)
 }
 
 
+//
+// R_GrowArray
+// Doubles one of the per frame refresh arrays, which
+//  then keeps its size, so a busy scene only costs
+//  an allocation the first time. Returns the new base.
+//
+void* R_GrowArray(void* array, int* max, int size, int initial)
+{
+    void* grown;
+    int newmax;
+
+    newmax = *max ? *max * 2 : initial;
+
+    grown = doom_malloc(newmax * size);
+    if (!grown)
+        I_Error("Error: R_GrowArray: out of memory");
+
+    if (array)
+    {
+        doom_memcpy(grown, array, *max * size);
+        doom_free(array);
+    }
+
+    *max = newmax;
+    return grown;
+}
+
+
 //
 // R_PointOnSide
 // Traverse BSP (sub) tree,
@@ -38697,10 +42370,10 @@ void R_ExecuteSetViewSize(void)
 
     if (!detailshift)
     {
-        colfunc = basecolfunc = R_DrawColumn;
+        colfunc = basecolfunc = drawcolumnfunc;
         fuzzcolfunc = R_DrawFuzzColumn;
         transcolfunc = R_DrawTranslatedColumn;
-        spanfunc = R_DrawSpan;
+        spanfunc = drawspanfunc;
     }
     else
     {
@@ -38762,6 +42435,24 @@ void R_ExecuteSetViewSize(void)
 //
 void R_Init(void)
 {
+    int p;
+    int count;
+
+    // Split the refresh over several threads?
+    p = M_CheckParm("-rthreads");
+    if (p && p < myargc - 1)
+    {
+        count = doom_atoi(myargv[p + 1]);
+        I_InitWorkers(count);
+        refreshworkers = count < numworkers ? count : numworkers;
+        if (refreshworkers < 1)
+            refreshworkers = 1;
+    }
+
+    // Only the floors and ceilings?
+    planerows = M_CheckParm("-rplanes");
+
+    R_InitDrawers();
     R_InitData();
     doom_print("\nR_InitData");
     R_InitPointToAngle();
@@ -38849,6 +42540,284 @@ void R_SetupFrame(player_t* player)
 }
 
 
+//
+// STRIP REFRESH
+// With -rthreads, the view is split into one vertical strip
+//  per worker. The BSP walk and all the clipping still happen
+//  on the main thread, since they depend on the whole width,
+//  but the wall columns are only queued. Each worker then
+//  draws the walls, planes and masked things of its strip.
+// Every pixel sees the same drawers in the same order as in
+//  a serial refresh, so the output is identical. The one
+//  exception is the fuzz effect, which steps a shared table
+//  position, so frames with shadows draw masked serially.
+//
+typedef struct
+{
+    int x;
+    int yl;
+    int yh;
+    fixed_t iscale;
+    fixed_t texturemid;
+    byte* source;
+    lighttable_t* colormap;
+} stripcolumn_t;
+
+typedef struct
+{
+    int x1;
+    int x2;
+    stripcolumn_t* columns;
+    int numcolumns;
+    int maxcolumns;
+} strip_t;
+
+strip_t strips[MAXWORKERS];
+int stripwidth;
+int refreshworkers = 1;
+
+// wall columns are being queued
+doom_boolean stripsactive;
+
+// masked things need the serial fuzz sequence
+doom_boolean stripfuzz;
+
+DOOM_THREADLOCAL int stripx1;
+DOOM_THREADLOCAL int stripx2;
+
+
+//
+// R_DrawWallColumn
+// Called by R_RenderSegLoop with the dc_ globals set up.
+//
+void R_DrawWallColumn(void)
+{
+    strip_t* strip;
+    stripcolumn_t* column;
+
+    if (!stripsactive)
+    {
+        colfunc();
+        return;
+    }
+
+    if (dc_yl > dc_yh)
+        return;
+
+    strip = &strips[dc_x / stripwidth];
+
+    if (strip->numcolumns == strip->maxcolumns)
+    {
+        // Grow the queue; it keeps its size between frames.
+        strip->maxcolumns = strip->maxcolumns ? strip->maxcolumns * 2 : 1024;
+        column = doom_malloc(strip->maxcolumns * sizeof(*column));
+        if (!column)
+            I_Error("Error: R_DrawWallColumn: couldn't grow strip");
+        if (strip->numcolumns)
+            doom_memcpy(column, strip->columns, strip->numcolumns * sizeof(*column));
+        doom_free(strip->columns);
+        strip->columns = column;
+    }
+
+    column = &strip->columns[strip->numcolumns++];
+    column->x = dc_x;
+    column->yl = dc_yl;
+    column->yh = dc_yh;
+    column->iscale = dc_iscale;
+    column->texturemid = dc_texturemid;
+    column->source = dc_source;
+    column->colormap = dc_colormap;
+}
+
+
+//
+// R_DrawStripColumns
+// Draws the wall columns queued for a strip.
+//
+void R_DrawStripColumns(strip_t* strip)
+{
+    stripcolumn_t* column;
+    stripcolumn_t* end;
+
+    end = strip->columns + strip->numcolumns;
+
+    for (column = strip->columns; column < end; column++)
+    {
+        dc_x = column->x;
+        dc_yl = column->yl;
+        dc_yh = column->yh;
+        dc_iscale = column->iscale;
+        dc_texturemid = column->texturemid;
+        dc_source = column->source;
+        dc_colormap = column->colormap;
+        basecolfunc();
+    }
+
+    strip->numcolumns = 0;
+}
+
+
+//
+// R_FlushStrips
+// The zone is about to purge a block that the queued columns
+//  may point into, so draw them now and refresh the rest
+//  of the frame serially.
+//
+void R_FlushStrips(void)
+{
+    int i;
+    int x;
+    int yl;
+    int yh;
+    fixed_t iscale;
+    fixed_t texturemid;
+    byte* source;
+    lighttable_t* colormap;
+
+    // We may be in the middle of setting up a column.
+    x = dc_x;
+    yl = dc_yl;
+    yh = dc_yh;
+    iscale = dc_iscale;
+    texturemid = dc_texturemid;
+    source = dc_source;
+    colormap = dc_colormap;
+
+    for (i = 0; i < refreshworkers; i++)
+        R_DrawStripColumns(&strips[i]);
+
+    dc_x = x;
+    dc_yl = yl;
+    dc_yh = yh;
+    dc_iscale = iscale;
+    dc_texturemid = texturemid;
+    dc_source = source;
+    dc_colormap = colormap;
+
+    stripsactive = false;
+}
+
+
+//
+// R_ClearStrips
+// At begining of frame.
+//
+void R_ClearStrips(void)
+{
+    int i;
+
+    stripx1 = 0;
+    stripx2 = viewwidth - 1;
+    stripsactive = refreshworkers > 1 && !planerows;
+
+    if (!stripsactive)
+        return;
+
+    stripwidth = (viewwidth + refreshworkers - 1) / refreshworkers;
+
+    for (i = 0; i < refreshworkers; i++)
+    {
+        strips[i].x1 = i * stripwidth;
+        strips[i].x2 = strips[i].x1 + stripwidth - 1;
+        if (strips[i].x2 >= viewwidth)
+            strips[i].x2 = viewwidth - 1;
+        strips[i].numcolumns = 0;
+    }
+
+    zonepurgefunc = R_FlushStrips;
+}
+
+
+//
+// R_CacheStrips
+// Brings in everything the workers are going to draw,
+//  so that none of them has to touch the zone.
+//
+void R_CacheStrips(void)
+{
+    drawseg_t* ds;
+    vissprite_t* spr;
+    pspdef_t* psp;
+    spriteframe_t* sprframe;
+    int texnum;
+    int x;
+    int i;
+
+    stripfuzz = !viewangleoffset
+        && (viewplayer->powers[pw_invisibility] > 4 * 32
+            || viewplayer->powers[pw_invisibility] & 8);
+
+    for (spr = vissprites; spr < vissprite_p; spr++)
+    {
+        if (!spr->colormap)
+            stripfuzz = true;
+    }
+
+    R_LockPlanes();
+
+    if (stripfuzz)
+        return;
+
+    for (ds = drawsegs; ds < ds_p && stripsactive; ds++)
+    {
+        if (!ds->maskedtexturecol)
+            continue;
+
+        texnum = texturetranslation[ds->curline->sidedef->midtexture];
+        for (x = ds->x1; x <= ds->x2; x++)
+        {
+            if (ds->maskedtexturecol[x] != DOOM_MAXSHORT)
+                R_GetColumn(texnum, ds->maskedtexturecol[x]);
+        }
+    }
+
+    for (spr = vissprites; spr < vissprite_p && stripsactive; spr++)
+        W_CacheLumpNum(spr->patch + firstspritelump, PU_CACHE);
+
+    if (viewangleoffset)
+        return;
+
+    for (i = 0, psp = viewplayer->psprites; i < NUMPSPRITES; i++, psp++)
+    {
+        if (!psp->state || !stripsactive)
+            continue;
+
+        sprframe = &sprites[psp->state->sprite].spriteframes[psp->state->frame & FF_FRAMEMASK];
+        W_CacheLumpNum(sprframe->lump[0] + firstspritelump, PU_CACHE);
+    }
+}
+
+
+//
+// R_DrawStrip
+// Worker job, draws one strip of the view.
+//
+void R_DrawStrip(int worker)
+{
+    strip_t* strip;
+
+    // the pool may be bigger, for -sightbatch
+    if (worker >= refreshworkers)
+        return;
+
+    strip = &strips[worker];
+
+    if (strip->x1 > strip->x2)
+        return;
+
+    stripx1 = strip->x1;
+    stripx2 = strip->x2;
+    colfunc = basecolfunc;
+    doom_memset(cachedheight, 0, sizeof(cachedheight));
+
+    R_DrawStripColumns(strip);
+    R_DrawPlanes();
+
+    if (!stripfuzz)
+        R_DrawMasked();
+}
+
+
 //
 // R_RenderView
 //
@@ -38861,6 +42830,7 @@ void R_RenderPlayerView(player_t* player)
     R_ClearDrawSegs();
     R_ClearPlanes();
     R_ClearSprites();
+    R_ClearStrips();
 
     // check for new console commands.
     NetUpdate();
@@ -38868,19 +42838,60 @@ void R_RenderPlayerView(player_t* player)
     // The head node is the last node output.
     R_RenderBSPNode(numnodes - 1);
 
+    // high water marks
+    if (lastvisplane - visplanes > peakvisplanes)
+        peakvisplanes = (int)(lastvisplane - visplanes);
+    if (ds_p - drawsegs > peakdrawsegs)
+        peakdrawsegs = (int)(ds_p - drawsegs);
+    if (vissprite_p - vissprites > peakvissprites)
+        peakvissprites = (int)(vissprite_p - vissprites);
+    if (lastopening - openings > peakopenings)
+        peakopenings = (int)(lastopening - openings);
+
     // Check for new console commands.
     NetUpdate();
 
-    R_DrawPlanes();
+    R_SortVisSprites();
 
-    // Check for new console commands.
-    NetUpdate();
+    if (stripsactive)
+        R_CacheStrips();
+
+    if (stripsactive)
+    {
+        I_RunWorkers(R_DrawStrip);
+
+        stripsactive = false;
+        zonepurgefunc = 0;
+        stripx1 = 0;
+        stripx2 = viewwidth - 1;
+        colfunc = basecolfunc;
+
+        R_UnlockPlanes();
+
+        // Check for new console commands.
+        NetUpdate();
 
-    R_DrawMasked();
+        if (stripfuzz)
+            R_DrawMasked();
+    }
+    else
+    {
+        // Serial walls, or the strips were flushed.
+        zonepurgefunc = 0;
+        R_UnlockPlanes();
+
+        R_DrawPlanes();
+
+        // Check for new console commands.
+        NetUpdate();
+
+        R_DrawMasked();
+    }
 
     // Check for new console commands.
     NetUpdate();
 }
+// Starting sizes, both grow as needed.
 #define MAXVISPLANES        128
 #define MAXOPENINGS        SCREENWIDTH*64
 
@@ -38893,14 +42904,29 @@ planefunction_t ceilingfunc;
 //
 
 // Here comes the obnoxious "visplane".
-visplane_t visplanes[MAXVISPLANES];
+visplane_t* visplanes;
 visplane_t* lastvisplane;
 visplane_t* floorplane;
 visplane_t* ceilingplane;
+int maxvisplanes;
+int peakvisplanes;
+
+// -rplanes: keep the walls serial and split
+//  the planes into bands of rows instead.
+doom_boolean planerows;
+
+// flats are held in the zone by R_LockPlanes
+doom_boolean planeslocked;
+
+// the rows this thread may draw into
+DOOM_THREADLOCAL int planey1 = 0;
+DOOM_THREADLOCAL int planey2 = SCREENHEIGHT - 1;
 
 // ?
-short openings[MAXOPENINGS];
+short* openings;
 short* lastopening;
+int maxopenings;
+int peakopenings;
 
 //
 // Clip values are the solid pixel bounding the range.
@@ -38914,24 +42940,24 @@ short ceilingclip[SCREENWIDTH];
 // spanstart holds the start of a plane span
 // initialized to 0 at start
 //
-int spanstart[SCREENHEIGHT];
+DOOM_THREADLOCAL int spanstart[SCREENHEIGHT];
 int spanstop[SCREENHEIGHT];
 
 //
 // texture mapping
 //
-lighttable_t** planezlight;
-fixed_t planeheight;
+DOOM_THREADLOCAL lighttable_t** planezlight;
+DOOM_THREADLOCAL fixed_t planeheight;
 
 fixed_t yslope[SCREENHEIGHT];
 fixed_t distscale[SCREENWIDTH];
 fixed_t basexscale;
 fixed_t baseyscale;
 
-fixed_t cachedheight[SCREENHEIGHT];
-fixed_t cacheddistance[SCREENHEIGHT];
-fixed_t cachedxstep[SCREENHEIGHT];
-fixed_t cachedystep[SCREENHEIGHT];
+DOOM_THREADLOCAL fixed_t cachedheight[SCREENHEIGHT];
+DOOM_THREADLOCAL fixed_t cacheddistance[SCREENHEIGHT];
+DOOM_THREADLOCAL fixed_t cachedxstep[SCREENHEIGHT];
+DOOM_THREADLOCAL fixed_t cachedystep[SCREENHEIGHT];
 
 
 //
@@ -38982,6 +43008,13 @@ void R_MapPlane(int y, int x1, int x2)
     }
 #endif
 
+    // not in the strip or rows being drawn?
+    if (x2 < stripx1 || x1 > stripx2)
+        return;
+
+    if (y < planey1 || y > planey2)
+        return;
+
     if (planeheight != cachedheight[y])
     {
         cachedheight[y] = planeheight;
@@ -39001,6 +43034,17 @@ void R_MapPlane(int y, int x1, int x2)
     ds_xfrac = viewx + FixedMul(finecosine[angle], length);
     ds_yfrac = -viewy - FixedMul(finesine[angle], length);
 
+    // clip to the strip, stepping as the span would have
+    if (x1 < stripx1)
+    {
+        ds_xfrac += (stripx1 - x1) * ds_xstep;
+        ds_yfrac += (stripx1 - x1) * ds_ystep;
+        x1 = stripx1;
+    }
+
+    if (x2 > stripx2)
+        x2 = stripx2;
+
     if (fixedcolormap)
         ds_colormap = fixedcolormap;
     else
@@ -39053,6 +43097,64 @@ void R_ClearPlanes(void)
 }
 
 
+//
+// R_CheckVisplanes
+// Makes room for one more visplane. Growing moves
+//  the array, so floorplane and ceilingplane move too.
+//
+void R_CheckVisplanes(void)
+{
+    visplane_t* old;
+
+    if (lastvisplane - visplanes < maxvisplanes)
+        return;
+
+    old = visplanes;
+    visplanes = R_GrowArray(visplanes, &maxvisplanes, sizeof(*visplanes), MAXVISPLANES);
+
+    lastvisplane = visplanes + (lastvisplane - old);
+    if (floorplane)
+        floorplane = visplanes + (floorplane - old);
+    if (ceilingplane)
+        ceilingplane = visplanes + (ceilingplane - old);
+}
+
+
+//
+// R_CheckOpenings
+// Makes room for count more openings. Growing moves
+//  the array, so the clip arrays of the drawsegs
+//  stored so far move too.
+//
+void R_CheckOpenings(int count)
+{
+    short* old;
+    drawseg_t* ds;
+
+    if (lastopening - openings + count <= maxopenings)
+        return;
+
+    old = openings;
+    while (lastopening - old + count > maxopenings)
+        openings = R_GrowArray(openings, &maxopenings, sizeof(*openings), MAXOPENINGS);
+
+#define MOVEOPENING(p) \
+    if ((p) && (p) != screenheightarray && (p) != negonearray) \
+        (p) = openings + ((p) - old)
+
+    for (ds = drawsegs; ds < ds_p; ds++)
+    {
+        MOVEOPENING(ds->maskedtexturecol);
+        MOVEOPENING(ds->sprtopclip);
+        MOVEOPENING(ds->sprbottomclip);
+    }
+
+#undef MOVEOPENING
+
+    lastopening = openings + (lastopening - old);
+}
+
+
 //
 // R_FindPlane
 //
@@ -39079,10 +43181,8 @@ visplane_t* R_FindPlane(fixed_t height, int picnum, int lightlevel)
     if (check < lastvisplane)
         return check;
 
-    if (lastvisplane - visplanes == MAXVISPLANES)
-        I_Error("Error: R_FindPlane: no more visplanes");
-
-    lastvisplane++;
+    R_CheckVisplanes();
+    check = lastvisplane++;
 
     check->height = height;
     check->picnum = picnum;
@@ -39101,6 +43201,7 @@ visplane_t* R_FindPlane(fixed_t height, int picnum, int lightlevel)
 //
 visplane_t* R_CheckPlane(visplane_t* pl, int start, int stop)
 {
+    int index;
     int intrl;
     int intrh;
     int unionl;
@@ -39143,6 +43244,10 @@ visplane_t* R_CheckPlane(visplane_t* pl, int start, int stop)
     }
 
     // make a new visplane
+    index = (int)(pl - visplanes);
+    R_CheckVisplanes();
+    pl = visplanes + index;
+
     lastvisplane->height = pl->height;
     lastvisplane->picnum = pl->picnum;
     lastvisplane->lightlevel = pl->lightlevel;
@@ -39187,57 +43292,25 @@ void R_MakeSpans(int x, int t1, int b1, int t2, int b2)
 
 
 //
-// R_DrawPlanes
-// At the end of each frame.
+// R_DrawPlaneList
+// Draws every visplane, within the current strip and rows.
 //
-void R_DrawPlanes(void)
+void R_DrawPlaneList(void)
 {
     visplane_t* pl;
     int light;
     int x;
+    int x2;
     int stop;
     int angle;
 
-#ifdef RANGECHECK
-    if (ds_p - drawsegs > MAXDRAWSEGS)
-    {
-        //I_Error("Error: R_DrawPlanes: drawsegs overflow (%i)",
-        //        ds_p - drawsegs);
-        
-        doom_strcpy(error_buf, "Error: R_DrawPlanes: drawsegs overflow (");
-        doom_concat(error_buf, doom_itoa((int)(ds_p - drawsegs), 10));
-        doom_concat(error_buf, ")");
-        I_Error(error_buf);
-    }
-
-    if (lastvisplane - visplanes > MAXVISPLANES)
-    {
-        //I_Error("Error: R_DrawPlanes: visplane overflow (%i)",
-        //        lastvisplane - visplanes);
-        
-        doom_strcpy(error_buf, "Error: R_DrawPlanes: visplane overflow (");
-        doom_concat(error_buf, doom_itoa((int)(lastvisplane - visplanes), 10));
-        doom_concat(error_buf, ")");
-        I_Error(error_buf);
-    }
-
-    if (lastopening - openings > MAXOPENINGS)
-    {
-        //I_Error("Error: R_DrawPlanes: opening overflow (%i)",
-        //        lastopening - openings);
-        
-        doom_strcpy(error_buf, "Error: R_DrawPlanes: opening overflow (");
-        doom_concat(error_buf, doom_itoa((int)(lastopening - openings), 10));
-        doom_concat(error_buf, ")");
-        I_Error(error_buf);
-    }
-#endif
-
     for (pl = visplanes; pl < lastvisplane; pl++)
     {
         if (pl->minx > pl->maxx)
             continue;
 
+        if (pl->maxx < stripx1 || pl->minx > stripx2)
+            continue;
 
         // sky flat
         if (pl->picnum == skyflatnum)
@@ -39250,11 +43323,19 @@ void R_DrawPlanes(void)
             //  by INVUL inverse mapping.
             dc_colormap = colormaps;
             dc_texturemid = skytexturemid;
-            for (x = pl->minx; x <= pl->maxx; x++)
+            x = pl->minx < stripx1 ? stripx1 : pl->minx;
+            x2 = pl->maxx > stripx2 ? stripx2 : pl->maxx;
+            for (; x <= x2; x++)
             {
                 dc_yl = pl->top[x];
                 dc_yh = pl->bottom[x];
 
+                if (dc_yl < planey1)
+                    dc_yl = planey1;
+
+                if (dc_yh > planey2)
+                    dc_yh = planey2;
+
                 if (dc_yl <= dc_yh)
                 {
                     angle = (viewangle + xtoviewangle[x]) >> ANGLETOSKYSHIFT;
@@ -39267,9 +43348,13 @@ void R_DrawPlanes(void)
         }
 
         // regular flat
-        ds_source = W_CacheLumpNum(firstflat +
-                                   flattranslation[pl->picnum],
-                                   PU_STATIC);
+        // (already locked by R_LockPlanes for the workers)
+        if (planeslocked)
+            ds_source = lumpcache[firstflat + flattranslation[pl->picnum]];
+        else
+            ds_source = W_CacheLumpNum(firstflat +
+                                       flattranslation[pl->picnum],
+                                       PU_STATIC);
 
         planeheight = doom_abs(pl->height - viewz);
         light = (pl->lightlevel >> LIGHTSEGSHIFT) + extralight;
@@ -39282,8 +43367,11 @@ void R_DrawPlanes(void)
 
         planezlight = zlight[light];
 
-        pl->top[pl->maxx + 1] = 0xff;
-        pl->top[pl->minx - 1] = 0xff;
+        if (!planeslocked)
+        {
+            pl->top[pl->maxx + 1] = 0xff;
+            pl->top[pl->minx - 1] = 0xff;
+        }
 
         stop = pl->maxx + 1;
 
@@ -39295,9 +43383,118 @@ void R_DrawPlanes(void)
                         pl->bottom[x]);
         }
 
-        Z_ChangeTag(ds_source, PU_CACHE);
+        if (!planeslocked)
+            Z_ChangeTag(ds_source, PU_CACHE);
+    }
+}
+
+
+//
+// R_DrawPlaneRows
+// Worker job, draws one band of rows of every visplane.
+//
+void R_DrawPlaneRows(int worker)
+{
+    if (worker >= refreshworkers)
+        return;
+
+    // the whole width, whichever strip the worker last drew
+    stripx1 = 0;
+    stripx2 = viewwidth - 1;
+    planey1 = worker * viewheight / refreshworkers;
+    planey2 = (worker + 1) * viewheight / refreshworkers - 1;
+    colfunc = basecolfunc;
+    doom_memset(cachedheight, 0, sizeof(cachedheight));
+
+    R_DrawPlaneList();
+}
+
+
+//
+// R_LockPlanes
+// Brings in the flats and sky the visplanes use, and holds
+//  the flats until R_UnlockPlanes, so that the workers never
+//  have to touch the zone.
+//
+void R_LockPlanes(void)
+{
+    visplane_t* pl;
+    int x;
+
+    planeslocked = true;
+
+    for (pl = visplanes; pl < lastvisplane; pl++)
+    {
+        if (pl->minx > pl->maxx || pl->picnum == skyflatnum)
+            continue;
+
+        W_CacheLumpNum(firstflat + flattranslation[pl->picnum], PU_STATIC);
+
+        pl->top[pl->maxx + 1] = 0xff;
+        pl->top[pl->minx - 1] = 0xff;
+    }
+
+    // After the flats, so that nothing can purge it again.
+    for (pl = visplanes; pl < lastvisplane; pl++)
+    {
+        if (pl->minx <= pl->maxx && pl->picnum == skyflatnum)
+        {
+            for (x = 0; x <= texturewidthmask[skytexture]; x++)
+                R_GetColumn(skytexture, x);
+            break;
+        }
+    }
+}
+
+
+//
+// R_UnlockPlanes
+// Lets the flats locked by R_LockPlanes be purged again.
+//
+void R_UnlockPlanes(void)
+{
+    visplane_t* pl;
+    int lump;
+
+    if (!planeslocked)
+        return;
+
+    planeslocked = false;
+
+    for (pl = visplanes; pl < lastvisplane; pl++)
+    {
+        if (pl->minx > pl->maxx || pl->picnum == skyflatnum)
+            continue;
+
+        lump = firstflat + flattranslation[pl->picnum];
+        if (lumpcache[lump])
+            Z_ChangeTag(lumpcache[lump], PU_CACHE);
     }
 }
+
+
+//
+// R_DrawPlanes
+// At the end of each frame.
+// With workers and no strips, every worker draws all the
+//  visplanes but only maps the rows of its own band,
+//  so no two of them write the same pixel.
+//
+void R_DrawPlanes(void)
+{
+    if (refreshworkers > 1 && !stripsactive)
+    {
+        R_LockPlanes();
+        I_RunWorkers(R_DrawPlaneRows);
+        R_UnlockPlanes();
+
+        planey1 = 0;
+        planey2 = SCREENHEIGHT - 1;
+        return;
+    }
+
+    R_DrawPlaneList();
+}
 #define HEIGHTBITS 12
 #define HEIGHTUNIT (1<<HEIGHTBITS)
 
@@ -39329,7 +43526,7 @@ angle_t rw_centerangle;
 fixed_t rw_offset;
 fixed_t rw_distance;
 fixed_t rw_scale;
-fixed_t rw_scalestep;
+DOOM_THREADLOCAL fixed_t rw_scalestep;
 fixed_t rw_midtexturemid;
 fixed_t rw_toptexturemid;
 fixed_t rw_bottomtexturemid;
@@ -39350,9 +43547,9 @@ fixed_t topstep;
 fixed_t bottomfrac;
 fixed_t bottomstep;
 
-lighttable_t** walllights;
+DOOM_THREADLOCAL lighttable_t** walllights;
 
-short* maskedtexturecol;
+DOOM_THREADLOCAL short* maskedtexturecol;
 
 
 //
@@ -39531,7 +43728,7 @@ void R_RenderSegLoop(void)
             dc_yh = yh;
             dc_texturemid = rw_midtexturemid;
             dc_source = R_GetColumn(midtexture, texturecolumn);
-            colfunc();
+            R_DrawWallColumn();
             ceilingclip[rw_x] = viewheight;
             floorclip[rw_x] = -1;
         }
@@ -39553,7 +43750,7 @@ void R_RenderSegLoop(void)
                     dc_yh = mid;
                     dc_texturemid = rw_toptexturemid;
                     dc_source = R_GetColumn(toptexture, texturecolumn);
-                    colfunc();
+                    R_DrawWallColumn();
                     ceilingclip[rw_x] = mid;
                 }
                 else
@@ -39583,7 +43780,7 @@ void R_RenderSegLoop(void)
                     dc_texturemid = rw_bottomtexturemid;
                     dc_source = R_GetColumn(bottomtexture,
                                             texturecolumn);
-                    colfunc();
+                    R_DrawWallColumn();
                     floorclip[rw_x] = mid;
                 }
                 else
@@ -39623,10 +43820,17 @@ void R_StoreWallRange(int start, int stop)
     angle_t distangle, offsetangle;
     fixed_t vtop;
     int lightnum;
+    int count;
 
-    // don't overflow and crash
-    if (ds_p == &drawsegs[MAXDRAWSEGS])
-        return;
+    // make room for this seg and its clip arrays
+    if (ds_p == drawsegs + maxdrawsegs)
+    {
+        count = (int)(ds_p - drawsegs);
+        drawsegs = R_GrowArray(drawsegs, &maxdrawsegs, sizeof(*drawsegs), MAXDRAWSEGS);
+        ds_p = drawsegs + count;
+    }
+
+    R_CheckOpenings(3 * (stop - start + 1));
 
 #ifdef RANGECHECK
     if (start >= viewwidth || start > stop)
@@ -40029,7 +44233,7 @@ typedef struct
 fixed_t pspritescale;
 fixed_t pspriteiscale;
 
-lighttable_t** spritelights;
+DOOM_THREADLOCAL lighttable_t** spritelights;
 
 // constant arrays
 //  used for psprite clipping and initializing clipping
@@ -40044,8 +44248,10 @@ int numsprites;
 spriteframe_t sprtemp[29];
 int maxframe;
 char* spritename;
-vissprite_t vissprites[MAXVISSPRITES];
+vissprite_t* vissprites;
 vissprite_t* vissprite_p;
+int maxvissprites;
+int peakvissprites;
 int newvissprite;
 vissprite_t vsprsortedhead;
 
@@ -40147,6 +44353,28 @@ void R_InstallSpriteLump(int lump, unsigned frame, unsigned rotation, doom_boole
 }
 
 
+//
+// R_SpriteNameSlot
+// Finds the slot for a 4 character sprite name,
+//  either the one holding it or the empty one
+//  where it would go.
+//
+int R_SpriteNameSlot(int* namehash, int size, char** namelist, int intname)
+{
+    int slot;
+
+    slot = (int)(((unsigned)intname * 0x9e3779b1u) >> 16) & (size - 1);
+
+    while (namehash[slot] != -1
+           && *(int*)namelist[namehash[slot]] != intname)
+    {
+        slot = (slot + 1) & (size - 1);
+    }
+
+    return slot;
+}
+
+
 //
 // R_InitSpriteDefs
 // Pass a null terminated list of sprite names
@@ -40173,6 +44401,13 @@ void R_InitSpriteDefs(char** namelist)
     int                start;
     int                end;
     int                patched;
+    int                slot;
+    int                size;
+    int*               namehash;
+    int*               first;
+    int*               last;
+    int*               next;
+    byte*              data;
 
     // count the number of sprite names
     check = namelist;
@@ -40186,12 +44421,67 @@ void R_InitSpriteDefs(char** namelist)
 
     sprites = Z_Malloc(numsprites * sizeof(*sprites), PU_STATIC, 0);
 
+    // already worked out by an earlier start?
+    if (startcachesprites)
+    {
+        data = startcachesprites;
+        for (i = 0; i < numsprites; i++)
+        {
+            sprites[i].numframes = *(int*)data;
+            sprites[i].spriteframes = (spriteframe_t*)(data + 4);
+            data += 4 + sprites[i].numframes * sizeof(spriteframe_t);
+        }
+        return;
+    }
+
     start = firstspritelump - 1;
     end = lastspritelump + 1;
 
-    // scan all the lump names for each of the names,
-    //  noting the highest frame letter.
+    // hash the sprite names, a slot holds the first
+    //  sprite with that name
+    for (size = 16; size < numsprites * 2; size <<= 1)
+        ;
+
+    namehash = doom_malloc(size * sizeof(*namehash));
+    first = doom_malloc(numsprites * sizeof(*first));
+    last = doom_malloc(numsprites * sizeof(*last));
+    next = doom_malloc((end - start) * sizeof(*next));
+
+    if (!namehash || !first || !last || !next)
+        I_Error("Error: R_InitSpriteDefs: out of memory");
+
+    doom_memset(namehash, -1, size * sizeof(*namehash));
+    doom_memset(first, -1, numsprites * sizeof(*first));
+
+    for (i = 0; i < numsprites; i++)
+    {
+        intname = *(int*)namelist[i];
+        slot = R_SpriteNameSlot(namehash, size, namelist, intname);
+        if (namehash[slot] == -1)
+            namehash[slot] = i;
+    }
+
+    // scan the lumps once, chaining them in order
+    //  onto the sprite of the same name.
     // Just compare 4 characters as ints
+    for (l = start + 1; l < end; l++)
+    {
+        intname = *(int*)lumpinfo[l].name;
+        i = namehash[R_SpriteNameSlot(namehash, size, namelist, intname)];
+
+        if (i == -1)
+            continue;
+
+        next[l - start] = -1;
+        if (first[i] == -1)
+            first[i] = l;
+        else
+            next[last[i] - start] = l;
+        last[i] = l;
+    }
+
+    // fill in the frames for each of the names,
+    //  noting the highest frame letter.
     for (i = 0; i < numsprites; i++)
     {
         spritename = namelist[i];
@@ -40200,28 +44490,27 @@ void R_InitSpriteDefs(char** namelist)
         maxframe = -1;
         intname = *(int*)namelist[i];
 
-        // scan the lumps,
+        // walk the lumps of this name,
         //  filling in the frames for whatever is found
-        for (l = start + 1; l < end; l++)
+        l = first[namehash[R_SpriteNameSlot(namehash, size, namelist, intname)]];
+
+        for (; l != -1; l = next[l - start])
         {
-            if (*(int*)lumpinfo[l].name == intname)
-            {
-                frame = lumpinfo[l].name[4] - 'A';
-                rotation = lumpinfo[l].name[5] - '0';
+            frame = lumpinfo[l].name[4] - 'A';
+            rotation = lumpinfo[l].name[5] - '0';
 
-                if (modifiedgame)
-                    patched = W_GetNumForName(lumpinfo[l].name);
-                else
-                    patched = l;
+            if (modifiedgame)
+                patched = W_GetNumForName(lumpinfo[l].name);
+            else
+                patched = l;
 
-                R_InstallSpriteLump(patched, frame, rotation, false);
+            R_InstallSpriteLump(patched, frame, rotation, false);
 
-                if (lumpinfo[l].name[6])
-                {
-                    frame = lumpinfo[l].name[6] - 'A';
-                    rotation = lumpinfo[l].name[7] - '0';
-                    R_InstallSpriteLump(l, frame, rotation, true);
-                }
+            if (lumpinfo[l].name[6])
+            {
+                frame = lumpinfo[l].name[6] - 'A';
+                rotation = lumpinfo[l].name[7] - '0';
+                R_InstallSpriteLump(l, frame, rotation, true);
             }
         }
 
@@ -40280,6 +44569,11 @@ void R_InitSpriteDefs(char** namelist)
             Z_Malloc(maxframe * sizeof(spriteframe_t), PU_STATIC, 0);
         doom_memcpy(sprites[i].spriteframes, sprtemp, maxframe * sizeof(spriteframe_t));
     }
+
+    doom_free(namehash);
+    doom_free(first);
+    doom_free(last);
+    doom_free(next);
 }
 
 
@@ -40301,6 +44595,7 @@ void R_InitSprites(char** namelist)
     }
 
     R_InitSpriteDefs(namelist);
+    R_SaveStartupCache();
 }
 
 
@@ -40317,12 +44612,16 @@ void R_ClearSprites(void)
 //
 // R_NewVisSprite
 //
-vissprite_t overflowsprite;
-
 vissprite_t* R_NewVisSprite(void)
 {
-    if (vissprite_p == &vissprites[MAXVISSPRITES])
-        return &overflowsprite;
+    int count;
+
+    if (vissprite_p == vissprites + maxvissprites)
+    {
+        count = (int)(vissprite_p - vissprites);
+        vissprites = R_GrowArray(vissprites, &maxvissprites, sizeof(*vissprites), MAXVISSPRITES);
+        vissprite_p = vissprites + count;
+    }
 
     vissprite_p++;
     return vissprite_p - 1;
@@ -40335,11 +44634,11 @@ vissprite_t* R_NewVisSprite(void)
 // Masked means: partly transparent, i.e. stored
 //  in posts/runs of opaque pixels.
 //
-short* mfloorclip;
-short* mceilingclip;
+DOOM_THREADLOCAL short* mfloorclip;
+DOOM_THREADLOCAL short* mceilingclip;
 
-fixed_t spryscale;
-fixed_t sprtopscreen;
+DOOM_THREADLOCAL fixed_t spryscale;
+DOOM_THREADLOCAL fixed_t sprtopscreen;
 
 void R_DrawMaskedColumn(column_t* column)
 {
@@ -40410,11 +44709,11 @@ void R_DrawVisSprite(vissprite_t* vis, int x1, int x2)
 
     dc_iscale = doom_abs(vis->xiscale) >> detailshift;
     dc_texturemid = vis->texturemid;
-    frac = vis->startfrac;
+    frac = vis->startfrac + (x1 - vis->x1) * vis->xiscale;
     spryscale = vis->scale;
     sprtopscreen = centeryfrac - FixedMul(dc_texturemid, spryscale);
 
-    for (dc_x = vis->x1; dc_x <= vis->x2; dc_x++, frac += vis->xiscale)
+    for (dc_x = x1; dc_x <= x2; dc_x++, frac += vis->xiscale)
     {
         texturecolumn = frac >> FRACBITS;
 #ifdef RANGECHECK
@@ -40749,7 +45048,12 @@ void R_DrawPSprite(pspdef_t* psp)
         vis->colormap = spritelights[MAXLIGHTSCALE - 1];
     }
 
-    R_DrawVisSprite(vis, vis->x1, vis->x2);
+    // clip to the strip being drawn
+    x1 = vis->x1 < stripx1 ? stripx1 : vis->x1;
+    x2 = vis->x2 > stripx2 ? stripx2 : vis->x2;
+
+    if (x1 <= x2)
+        R_DrawVisSprite(vis, x1, x2);
 }
 
 
@@ -40791,54 +45095,90 @@ void R_DrawPlayerSprites(void)
 
 //
 // R_SortVisSprites
+// Links the vissprites into vsprsortedhead from back to
+//  front. This is a stable radix sort on the scale, so equal
+//  scales keep the order the BSP walk found them in, just
+//  like the selection sort it replaces.
 //
+vissprite_t** sortsprites;
+vissprite_t** sorttemp;
+int maxsortsprites;
+int maxsorttemp;
+
 void R_SortVisSprites(void)
 {
     int i;
     int count;
+    int shift;
+    int total;
+    int n;
+    int counts[256];
+    unsigned diff;
+    vissprite_t** src;
+    vissprite_t** dst;
+    vissprite_t** swap;
     vissprite_t* ds;
-    vissprite_t* best;
-    vissprite_t unsorted;
-    fixed_t bestscale;
 
     count = (int)(vissprite_p - vissprites);
 
-    unsorted.next = unsorted.prev = &unsorted;
+    vsprsortedhead.next = vsprsortedhead.prev = &vsprsortedhead;
 
     if (!count)
         return;
 
-    for (ds = vissprites; ds < vissprite_p; ds++)
+    while (maxsortsprites < count)
+        sortsprites = R_GrowArray(sortsprites, &maxsortsprites, sizeof(*sortsprites), MAXVISSPRITES);
+    while (maxsorttemp < count)
+        sorttemp = R_GrowArray(sorttemp, &maxsorttemp, sizeof(*sorttemp), MAXVISSPRITES);
+
+    // Bytes that are the same in every key need no pass.
+    diff = 0;
+    for (i = 0; i < count; i++)
     {
-        ds->next = ds + 1;
-        ds->prev = ds - 1;
+        sortsprites[i] = &vissprites[i];
+        diff |= (unsigned)(vissprites[i].scale ^ vissprites[0].scale);
     }
 
-    vissprites[0].prev = &unsorted;
-    unsorted.next = &vissprites[0];
-    (vissprite_p - 1)->next = &unsorted;
-    unsorted.prev = vissprite_p - 1;
+    // Flipping the sign bit makes the signed
+    //  scales order as unsigned keys.
+#define SORTKEY(spr) ((unsigned)(spr)->scale ^ 0x80000000u)
 
-    // pull the vissprites out by scale
-    //best = 0;                // shut up the compiler warning
-    vsprsortedhead.next = vsprsortedhead.prev = &vsprsortedhead;
-    for (i = 0; i < count; i++)
+    src = sortsprites;
+    dst = sorttemp;
+
+    for (shift = 0; shift < 32; shift += 8)
     {
-        bestscale = DOOM_MAXINT;
-        for (ds = unsorted.next; ds != &unsorted; ds = ds->next)
+        if (!((diff >> shift) & 0xff))
+            continue;
+
+        doom_memset(counts, 0, sizeof(counts));
+        for (i = 0; i < count; i++)
+            counts[(SORTKEY(src[i]) >> shift) & 0xff]++;
+
+        for (i = 0, total = 0; i < 256; i++)
         {
-            if (ds->scale < bestscale)
-            {
-                bestscale = ds->scale;
-                best = ds;
-            }
+            n = counts[i];
+            counts[i] = total;
+            total += n;
         }
-        best->next->prev = best->prev;
-        best->prev->next = best->next;
-        best->next = &vsprsortedhead;
-        best->prev = vsprsortedhead.prev;
-        vsprsortedhead.prev->next = best;
-        vsprsortedhead.prev = best;
+
+        for (i = 0; i < count; i++)
+            dst[counts[(SORTKEY(src[i]) >> shift) & 0xff]++] = src[i];
+
+        swap = src;
+        src = dst;
+        dst = swap;
+    }
+
+#undef SORTKEY
+
+    for (i = 0; i < count; i++)
+    {
+        ds = src[i];
+        ds->next = &vsprsortedhead;
+        ds->prev = vsprsortedhead.prev;
+        vsprsortedhead.prev->next = ds;
+        vsprsortedhead.prev = ds;
     }
 }
 
@@ -40852,13 +45192,22 @@ void R_DrawSprite(vissprite_t* spr)
     short clipbot[SCREENWIDTH];
     short cliptop[SCREENWIDTH];
     int x;
+    int x1;
+    int x2;
     int r1;
     int r2;
     fixed_t scale;
     fixed_t lowscale;
     int silhouette;
 
-    for (x = spr->x1; x <= spr->x2; x++)
+    // clip to the strip being drawn
+    x1 = spr->x1 < stripx1 ? stripx1 : spr->x1;
+    x2 = spr->x2 > stripx2 ? stripx2 : spr->x2;
+
+    if (x1 > x2)
+        return;
+
+    for (x = x1; x <= x2; x++)
         clipbot[x] = cliptop[x] = -2;
 
     // Scan drawsegs from end to start for obscuring segs.
@@ -40867,8 +45216,8 @@ void R_DrawSprite(vissprite_t* spr)
     for (ds = ds_p - 1; ds >= drawsegs; ds--)
     {
         // determine if the drawseg obscures the sprite
-        if (ds->x1 > spr->x2
-            || ds->x2 < spr->x1
+        if (ds->x1 > x2
+            || ds->x2 < x1
             || (!ds->silhouette
                 && !ds->maskedtexturecol))
         {
@@ -40876,8 +45225,8 @@ void R_DrawSprite(vissprite_t* spr)
             continue;
         }
 
-        r1 = ds->x1 < spr->x1 ? spr->x1 : ds->x1;
-        r2 = ds->x2 > spr->x2 ? spr->x2 : ds->x2;
+        r1 = ds->x1 < x1 ? x1 : ds->x1;
+        r2 = ds->x2 > x2 ? x2 : ds->x2;
 
         if (ds->scale1 > ds->scale2)
         {
@@ -40941,7 +45290,7 @@ void R_DrawSprite(vissprite_t* spr)
     // all clipping has been performed, so draw the sprite
 
     // check for unclipped columns
-    for (x = spr->x1; x <= spr->x2; x++)
+    for (x = x1; x <= x2; x++)
     {
         if (clipbot[x] == -2)
             clipbot[x] = viewheight;
@@ -40952,7 +45301,7 @@ void R_DrawSprite(vissprite_t* spr)
 
     mfloorclip = clipbot;
     mceilingclip = cliptop;
-    R_DrawVisSprite(spr, spr->x1, spr->x2);
+    R_DrawVisSprite(spr, x1, x2);
 }
 
 
@@ -40963,8 +45312,8 @@ void R_DrawMasked(void)
 {
     vissprite_t* spr;
     drawseg_t* ds;
-
-    R_SortVisSprites();
+    int x1;
+    int x2;
 
     if (vissprite_p > vissprites)
     {
@@ -40980,8 +45329,16 @@ void R_DrawMasked(void)
 
     // render any remaining masked mid textures
     for (ds = ds_p - 1; ds >= drawsegs; ds--)
-        if (ds->maskedtexturecol)
-            R_RenderMaskedSegRange(ds, ds->x1, ds->x2);
+    {
+        if (!ds->maskedtexturecol)
+            continue;
+
+        x1 = ds->x1 < stripx1 ? stripx1 : ds->x1;
+        x2 = ds->x2 > stripx2 ? stripx2 : ds->x2;
+
+        if (x1 <= x2)
+            R_RenderMaskedSegRange(ds, x1, x2);
+    }
 
     // draw the psprites on top of everything
     //  but does not draw on side views
@@ -41180,6 +45537,10 @@ void S_StartSoundAtVolume(void* origin_p, int sfx_id, int volume)
 
     mobj_t* origin = (mobj_t*)origin_p;
 
+    // nothing is heard while a demo is fast-forwarded
+    if (seektic >= 0)
+        return;
+
     // check for bogus sound #
     if (sfx_id < 1 || sfx_id > NUMSFX)
     {
@@ -41277,18 +45638,16 @@ void S_StartSoundAtVolume(void* origin_p, int sfx_id, int volume)
 
 #ifndef SNDSRV
     // cache data if necessary
-    if (!sfx->data)
-    {
-        doom_print(
-                "S_StartSoundAtVolume: 16bit and not pre-cached - wtf?\n");
-
+    // The data is loaded by I_StartSound, so a sound that
+    //  hasn't been played yet has none here.
+    //if (!sfx->data)
+    //{
         // DOS remains, 8bit handling
         //sfx->data = (void *) W_CacheLumpNum(sfx->lumpnum, PU_MUSIC);
         // fprintf( stderr,
         //             "S_StartSoundAtVolume: loading %d (lump %d) : 0x%x\n",
         //       sfx_id, sfx->lumpnum, (int)sfx->data );
-
-    }
+    //}
 #endif
 
     // increase the usefulness
@@ -45864,6 +50223,10 @@ char* reloadname;
 int info[2500][10];
 int profilecount;
 
+// Lump numbers by name, see W_HashLumps.
+int* lumphash;
+int lumphashmask;
+
 
 void doom_strupr(char* s)
 {
@@ -45909,6 +50272,160 @@ void ExtractFileBase(char* path, char* dest)
 }
 
 
+//
+// MAPPED WAD FILES.
+//
+
+#if defined(DOOM_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define MAXWADMAPS 32
+
+typedef struct
+{
+    byte* base;
+    int size;
+} wadmap_t;
+
+doom_boolean wadmapping;
+wadmap_t wadmaps[MAXWADMAPS];
+int numwadmaps;
+
+
+//
+// W_MapFile
+// Maps a whole file copy-on-write, so the pages stay shared
+//  with every other process using the same file, and a lump
+//  that gets changed in place only costs the pages it touches.
+// Returns 0 if the file can't be mapped.
+//
+byte* W_MapFile(char* filename, int* size)
+{
+#if defined(DOOM_WIN32)
+    HANDLE file;
+    HANDLE mapping;
+    LARGE_INTEGER length;
+    byte* base;
+
+    file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, 0,
+                       OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+    if (file == INVALID_HANDLE_VALUE)
+        return 0;
+
+    if (!GetFileSizeEx(file, &length)
+        || length.QuadPart <= 0
+        || length.QuadPart > DOOM_MAXINT)
+    {
+        CloseHandle(file);
+        return 0;
+    }
+
+    mapping = CreateFileMappingA(file, 0, PAGE_WRITECOPY, 0, 0, 0);
+    CloseHandle(file);
+    if (!mapping)
+        return 0;
+
+    // the view keeps the mapping alive
+    base = (byte*)MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+    CloseHandle(mapping);
+
+    *size = (int)length.QuadPart;
+    return base;
+#else
+    int fd;
+    struct stat st;
+    void* base;
+
+    fd = open(filename, O_RDONLY);
+    if (fd < 0)
+        return 0;
+
+    if (fstat(fd, &st) < 0
+        || st.st_size <= 0
+        || st.st_size > DOOM_MAXINT)
+    {
+        close(fd);
+        return 0;
+    }
+
+    base = mmap(0, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+        return 0;
+
+    *size = (int)st.st_size;
+    return (byte*)base;
+#endif
+}
+
+
+//
+// W_UnmapFile
+//
+void W_UnmapFile(byte* base, int size)
+{
+#if defined(DOOM_WIN32)
+    UnmapViewOfFile(base);
+#else
+    munmap(base, size);
+#endif
+}
+
+
+//
+// W_FileStamp
+//
+doom_boolean W_FileStamp(char* filename, long long* size, long long* mtime)
+{
+#if defined(DOOM_WIN32)
+    WIN32_FILE_ATTRIBUTE_DATA data;
+
+    if (!GetFileAttributesExA(filename, GetFileExInfoStandard, &data))
+        return false;
+
+    *size = ((long long)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+    *mtime = ((long long)data.ftLastWriteTime.dwHighDateTime << 32)
+        | data.ftLastWriteTime.dwLowDateTime;
+    return true;
+#else
+    struct stat st;
+
+    if (stat(filename, &st) < 0)
+        return false;
+
+    *size = st.st_size;
+    *mtime = st.st_mtime;
+    return true;
+#endif
+}
+
+
+//
+// W_IsMapped
+//
+doom_boolean W_IsMapped(void* ptr)
+{
+    int i;
+
+    for (i = 0; i < numwadmaps; i++)
+    {
+        if ((byte*)ptr >= wadmaps[i].base
+            && (byte*)ptr < wadmaps[i].base + wadmaps[i].size)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
 //
 // LUMP BASED ROUTINES.
 //
@@ -45937,6 +50454,8 @@ void W_AddFile(char* filename)
     filelump_t singleinfo;
     void* storehandle;
     void* allocated = 0;
+    byte* mapbase;
+    int mapsize;
 
     // open the file and add to directory
 
@@ -46018,12 +50537,43 @@ void W_AddFile(char* filename)
 
     storehandle = reloadname ? 0 : handle;
 
+    // Map WAD files, but not reloadable ones, which change
+    //  under us, or single lumps, which have no header in
+    //  front of their data.
+    mapbase = 0;
+    mapsize = 0;
+    if (wadmapping
+        && storehandle
+        && fileinfo != &singleinfo
+        && numwadmaps < MAXWADMAPS)
+    {
+        mapbase = W_MapFile(filename, &mapsize);
+        if (mapbase)
+        {
+            wadmaps[numwadmaps].base = mapbase;
+            wadmaps[numwadmaps].size = mapsize;
+            numwadmaps++;
+        }
+    }
+
     for (i = startlump; i < (unsigned)numlumps; i++, lump_p++, fileinfo++)
     {
         lump_p->handle = storehandle;
         lump_p->position = LONG(fileinfo->filepos);
         lump_p->size = LONG(fileinfo->size);
         doom_strncpy(lump_p->name, fileinfo->name, 8);
+
+        // Lumps that are aligned like a zone block
+        //  can be used where they are.
+        lump_p->data = 0;
+        if (mapbase
+            && lump_p->size > 0
+            && lump_p->position > 0
+            && !(lump_p->position & 3)
+            && lump_p->size <= mapsize - lump_p->position)
+        {
+            lump_p->data = mapbase + lump_p->position;
+        }
     }
 
     if (reloadname)
@@ -46037,6 +50587,8 @@ void W_AddFile(char* filename)
 // W_Reload
 // Flushes any of the reloadable lumps in memory
 //  and reloads the directory.
+// Only positions and sizes change, so the name
+//  hash from W_HashLumps stays valid.
 //
 void W_Reload(void)
 {
@@ -46087,6 +50639,58 @@ void W_Reload(void)
 }
 
 
+//
+// W_HashName
+// Mixes the two halves of a lump name.
+//
+unsigned W_HashName(int v1, int v2)
+{
+    unsigned hash;
+
+    hash = (unsigned)v1 * 0x9e3779b1u;
+    hash ^= (unsigned)v2 + (hash >> 15);
+    hash *= 0x85ebca6bu;
+    return hash ^ (hash >> 13);
+}
+
+
+//
+// W_HashLumps
+// Chains every lump into a table indexed by name.
+// Lumps are pushed in order, so each chain starts
+//  at the last lump of that name and a later file
+//  still overrides all earlier ones.
+//
+void W_HashLumps(void)
+{
+    int i;
+    int size;
+    unsigned hash;
+
+    if (lumphash)
+        doom_free(lumphash);
+
+    for (size = 64; size < numlumps * 2; size <<= 1)
+        ;
+
+    lumphash = doom_malloc(size * sizeof(*lumphash));
+    if (!lumphash)
+        I_Error("Error: Couldn't allocate lumphash");
+
+    lumphashmask = size - 1;
+    doom_memset(lumphash, -1, size * sizeof(*lumphash));
+
+    for (i = 0; i < numlumps; i++)
+    {
+        hash = W_HashName(*(int*)lumpinfo[i].name,
+                          *(int*)&lumpinfo[i].name[4]);
+        hash &= lumphashmask;
+        lumpinfo[i].next = lumphash[hash];
+        lumphash[hash] = i;
+    }
+}
+
+
 //
 // W_InitMultipleFiles
 // Pass a null terminated list of files to use.
@@ -46110,6 +50714,12 @@ void W_InitMultipleFiles(char** filenames)
     // will be realloced as lumps are added
     lumpinfo = doom_malloc(1);
 
+#if !defined(__BIG_ENDIAN__)
+    // Big endian builds swap some lumps in place,
+    //  which a mapping would keep between levels.
+    wadmapping = M_CheckParm("-mmap");
+#endif
+
     for (; *filenames; filenames++)
         W_AddFile(*filenames);
 
@@ -46124,6 +50734,8 @@ void W_InitMultipleFiles(char** filenames)
         I_Error("Error: Couldn't allocate lumpcache");
 
     doom_memset(lumpcache, 0, size);
+
+    W_HashLumps();
 }
 
 
@@ -46164,6 +50776,7 @@ int W_CheckNumForName(char* name)
 
     int v1;
     int v2;
+    int i;
     lumpinfo_t* lump_p;
 
     // make the name into two integers for easy compares
@@ -46179,16 +50792,23 @@ int W_CheckNumForName(char* name)
     v2 = name8.x[1];
 
 
-    // scan backwards so patch lump files take precedence
-    lump_p = lumpinfo + numlumps;
+    if (!lumphash)
+        return -1;
 
-    while (lump_p-- != lumpinfo)
+    // chains run backwards so patch lump files take precedence
+    i = lumphash[W_HashName(v1, v2) & lumphashmask];
+
+    while (i != -1)
     {
+        lump_p = &lumpinfo[i];
+
         if (*(int*)lump_p->name == v1
             && *(int*)&lump_p->name[4] == v2)
         {
-            return (int)(lump_p - lumpinfo);
+            return i;
         }
+
+        i = lump_p->next;
     }
 
     // TFB. Not found.
@@ -46281,6 +50901,11 @@ void W_ReadLump(int lump, void* dest)
             I_Error(error_buf);
         }
     }
+    else if (l->data)
+    {
+        doom_memcpy(dest, l->data, l->size);
+        return;
+    }
     else
         handle = l->handle;
 
@@ -46323,8 +50948,21 @@ void* W_CacheLumpNum(int lump, int tag)
         I_Error(error_buf);
     }
 
-    if (!lumpcache[lump])
+    if (lumpinfo[lump].data)
     {
+        // Used straight out of the mapped file,
+        //  so it is never read in or purged.
+        lumpcache[lump] = lumpinfo[lump].data;
+    }
+    else if (!lumpcache[lump])
+    {
+        if (precachelumps && precachelumps[lump])
+        {
+            // the precache queue had not got to it yet
+            precachestalls++;
+            precachelumps[lump] = 0;
+        }
+
         // read the lump in
 
         //doom_print ("cache miss on lump %i\n",lump);
@@ -46334,7 +50972,10 @@ void* W_CacheLumpNum(int lump, int tag)
     else
     {
         //doom_print ("cache hit on lump %i\n",lump);
-        Z_ChangeTag(lumpcache[lump], tag);
+        // Leave the block alone if the tag is unchanged, so that
+        //  render workers can share cached lumps without writes.
+        if (((memblock_t*)((byte*)lumpcache[lump] - sizeof(memblock_t)))->tag != tag)
+            Z_ChangeTag(lumpcache[lump], tag);
     }
 
     return lumpcache[lump];
@@ -46371,6 +51012,8 @@ void W_Profile(void)
             ch = ' ';
             continue;
         }
+        else if (W_IsMapped(ptr))
+            ch = 'M';
         else
         {
             block = (memblock_t*)((byte*)ptr - sizeof(memblock_t));
@@ -48155,8 +52798,29 @@ void WI_Start(wbstartstruct_t* wbstartstruct)
         WI_initStats();
 }
 #define ZONEID 0x1d4a11
+#define ZONECHUNKID 0x1d4a12
 #define MINFRAGMENT 64
 
+// The zone starts at ZONECHUNK bytes and grows by at least
+//  as much at a time, up to ZONEMAX (-zonemax, in MB).
+#define ZONECHUNK (1024 * 1024)
+#define ZONEMAX (128 * 1024 * 1024)
+
+
+#if !defined(DOOM_CLASSIC_ZONE)
+typedef struct zonechunk_s
+{
+    struct zonechunk_s* next;
+
+    // total bytes malloced, including this header
+    int size;
+
+    // an in use block in front of the chunk's blocks,
+    //  so that nothing merges across chunks
+    memblock_t head;
+} zonechunk_t;
+#endif
+
 
 typedef struct
 {
@@ -48167,11 +52831,87 @@ typedef struct
     memblock_t blocklist;
 
     memblock_t* rover;
+
+#if !defined(DOOM_CLASSIC_ZONE)
+    // chunks added after the first
+    zonechunk_t* chunks;
+
+    // grow rather than purge below this size
+    int softsize;
+
+    // never grow past this size
+    int maxsize;
+#endif
 } memzone_t;
 
 
 memzone_t* mainzone;
 
+void (*zonepurgefunc)(void);
+
+int zonemallocs;
+int zonefrees;
+int zonepurges;
+int zonescans;
+
+
+#if !defined(DOOM_CLASSIC_ZONE)
+
+#define NUMZONEBINS 32
+
+// Free blocks, binned by the highest set bit of their size.
+memblock_t* zonebins[NUMZONEBINS];
+unsigned zonebinmask;
+
+
+static int Z_SizeBin(int size)
+{
+    int bin;
+
+    for (bin = 0; size > 1; size >>= 1)
+        bin++;
+
+    return bin;
+}
+
+
+static void Z_LinkFree(memblock_t* block)
+{
+    int bin;
+
+    bin = Z_SizeBin(block->size);
+
+    block->freeprev = 0;
+    block->freenext = zonebins[bin];
+    if (block->freenext)
+        block->freenext->freeprev = block;
+
+    zonebins[bin] = block;
+    zonebinmask |= 1u << bin;
+}
+
+
+// Must be done before the block changes size.
+static void Z_UnlinkFree(memblock_t* block)
+{
+    int bin;
+
+    if (block->freenext)
+        block->freenext->freeprev = block->freeprev;
+
+    if (block->freeprev)
+        block->freeprev->freenext = block->freenext;
+    else
+    {
+        bin = Z_SizeBin(block->size);
+        zonebins[bin] = block->freenext;
+        if (!zonebins[bin])
+            zonebinmask &= ~(1u << bin);
+    }
+}
+
+#endif
+
 
 //
 // Z_ClearZone
@@ -48195,6 +52935,12 @@ void Z_ClearZone(memzone_t* zone)
     block->user = 0;
 
     block->size = zone->size - sizeof(memzone_t);
+
+#if !defined(DOOM_CLASSIC_ZONE)
+    doom_memset(zonebins, 0, sizeof(zonebins));
+    zonebinmask = 0;
+    Z_LinkFree(block);
+#endif
 }
 
 
@@ -48205,8 +52951,32 @@ void Z_Init(void)
 {
     memblock_t* block;
     int size;
+#if !defined(DOOM_CLASSIC_ZONE)
+    int p;
+#endif
 
+#if defined(DOOM_CLASSIC_ZONE)
     mainzone = (memzone_t*)I_ZoneBase(&size);
+#else
+    // Start small, Z_AddChunk grows it as needed.
+    size = ZONECHUNK;
+    mainzone = (memzone_t*)doom_malloc(size);
+    if (!mainzone)
+        I_Error("Error: Z_Init: couldn't allocate the zone");
+
+    mainzone->chunks = 0;
+    mainzone->softsize = I_GetHeapSize();
+    mainzone->maxsize = ZONEMAX;
+
+    p = M_CheckParm("-zonemax");
+    if (p && p < myargc - 1)
+    {
+        p = doom_atoi(myargv[p + 1]);
+        if (p > 2047)
+            p = 2047;
+        mainzone->maxsize = p * 1024 * 1024;
+    }
+#endif
     mainzone->size = size;
 
     // set the entire zone to one free block
@@ -48224,9 +52994,15 @@ void Z_Init(void)
     block->user = 0;
 
     block->size = mainzone->size - sizeof(memzone_t);
+
+#if !defined(DOOM_CLASSIC_ZONE)
+    Z_LinkFree(block);
+#endif
 }
 
 
+#if defined(DOOM_CLASSIC_ZONE)
+
 //
 // Z_Free
 //
@@ -48235,6 +53011,10 @@ void Z_Free(void* ptr)
     memblock_t* block;
     memblock_t* other;
 
+    // a lump in a mapped WAD file
+    if (W_IsMapped(ptr))
+        return;
+
     block = (memblock_t*)((byte*)ptr - sizeof(memblock_t));
 
     if (block->id != ZONEID)
@@ -48254,6 +53034,8 @@ void Z_Free(void* ptr)
     block->tag = 0;
     block->id = 0;
 
+    zonefrees++;
+
     other = block->prev;
 
     if (!other->user)
@@ -48327,6 +53109,8 @@ void* Z_Malloc(int size, int tag, void* user)
             I_Error(error_buf);
         }
 
+        zonescans++;
+
         if (rover->user)
         {
             if (rover->tag < PU_PURGELEVEL)
@@ -48337,6 +53121,16 @@ void* Z_Malloc(int size, int tag, void* user)
             }
             else
             {
+                if (zonepurgefunc)
+                {
+                    void (*purgefunc)(void) = zonepurgefunc;
+
+                    zonepurgefunc = 0;
+                    purgefunc();
+                }
+
+                zonepurges++;
+
                 // free the rover block (adding the size to base)
 
                 // the rover can be the base block
@@ -48392,10 +53186,392 @@ void* Z_Malloc(int size, int tag, void* user)
 
     base->id = ZONEID;
 
+    zonemallocs++;
+
     return (void*)((byte*)base + sizeof(memblock_t));
 }
 
 
+#else
+
+//
+// Z_FreeBlock
+// Returns the free block it ended up in,
+//  after merging with its neighbours.
+//
+memblock_t* Z_FreeBlock(memblock_t* block)
+{
+    memblock_t* other;
+
+    if (block->user > (void**)0x100)
+    {
+        // smaller values are not pointers
+        // Note: OS-dependend?
+
+        // clear the user's mark
+        *block->user = 0;
+    }
+
+    // mark as free
+    block->user = 0;
+    block->tag = 0;
+    block->id = 0;
+
+    zonefrees++;
+
+    // The merged blocks keep their next links, so Z_FreeTags
+    //  can step through them as in the original.
+    other = block->prev;
+
+    if (!other->user)
+    {
+        // merge with previous free block
+        Z_UnlinkFree(other);
+        other->size += block->size;
+        other->next = block->next;
+        other->next->prev = other;
+
+        if (block == mainzone->rover)
+            mainzone->rover = other;
+
+        block = other;
+    }
+
+    other = block->next;
+    if (!other->user)
+    {
+        // merge the next free block onto the end
+        Z_UnlinkFree(other);
+        block->size += other->size;
+        block->next = other->next;
+        block->next->prev = block;
+
+        if (other == mainzone->rover)
+            mainzone->rover = block;
+    }
+
+    Z_LinkFree(block);
+
+    return block;
+}
+
+
+//
+// Z_Free
+//
+void Z_Free(void* ptr)
+{
+    memblock_t* block;
+
+    // a lump in a mapped WAD file
+    if (W_IsMapped(ptr))
+        return;
+
+    block = (memblock_t*)((byte*)ptr - sizeof(memblock_t));
+
+    if (block->id != ZONEID)
+        I_Error("Error: Z_Free: freed a pointer without ZONEID");
+
+    Z_FreeBlock(block);
+}
+
+
+//
+// Z_FindFree
+// A free block of at least size bytes, or 0.
+// Anything in a higher bin fits, so only the
+//  request's own bin needs searching.
+//
+memblock_t* Z_FindFree(int size)
+{
+    memblock_t* block;
+    int bin;
+    int i;
+
+    bin = Z_SizeBin(size);
+
+    for (i = bin + 1; i < NUMZONEBINS; i++)
+    {
+        if (zonebinmask & (1u << i))
+            return zonebins[i];
+    }
+
+    for (block = zonebins[bin]; block; block = block->freenext)
+    {
+        zonescans++;
+
+        if (block->size >= size)
+            return block;
+    }
+
+    return 0;
+}
+
+
+//
+// Z_PurgeFor
+// Throws out purgable blocks, going round the zone from
+//  the rover like the original allocator, until the
+//  space freed makes a block of at least size bytes.
+//
+memblock_t* Z_PurgeFor(int size)
+{
+    memblock_t* block;
+    doom_boolean wrapped;
+
+    block = mainzone->rover;
+    wrapped = false;
+
+    for (;;)
+    {
+        if (block == &mainzone->blocklist)
+        {
+            if (wrapped)
+                break;
+
+            wrapped = true;
+            block = block->next;
+            continue;
+        }
+
+        // back round to the rover, which Z_FreeBlock
+        //  keeps on the block that swallowed it
+        if (wrapped && block == mainzone->rover)
+            break;
+
+        zonescans++;
+
+        if (block->user && block->tag >= PU_PURGELEVEL)
+        {
+            if (zonepurgefunc)
+            {
+                void (*purgefunc)(void) = zonepurgefunc;
+
+                zonepurgefunc = 0;
+                purgefunc();
+            }
+
+            zonepurges++;
+
+            block = Z_FreeBlock(block);
+            if (block->size >= size)
+                return block;
+        }
+
+        block = block->next;
+    }
+
+    return 0;
+}
+
+
+//
+// Z_AddChunk
+// Grows the zone by a chunk with room for size bytes,
+//  unless that would take it past the maximum.
+// Returns the chunk's free block, or 0.
+//
+memblock_t* Z_AddChunk(int size)
+{
+    zonechunk_t* chunk;
+    memblock_t* block;
+    int chunksize;
+
+    chunksize = (int)sizeof(zonechunk_t) + size;
+    if (chunksize < ZONECHUNK)
+        chunksize = ZONECHUNK;
+
+    if (chunksize > mainzone->maxsize - mainzone->size)
+        return 0;
+
+    chunk = (zonechunk_t*)doom_malloc(chunksize);
+    if (!chunk)
+        return 0;
+
+    chunk->size = chunksize;
+    chunk->next = mainzone->chunks;
+    mainzone->chunks = chunk;
+    mainzone->size += chunksize;
+
+    block = (memblock_t*)((byte*)chunk + sizeof(zonechunk_t));
+
+    // in use, but unowned
+    chunk->head.size = (int)((byte*)block - (byte*)&chunk->head);
+    chunk->head.user = (void*)2;
+    chunk->head.tag = PU_STATIC;
+    chunk->head.id = ZONECHUNKID;
+
+    // 0 indicates a free block.
+    block->size = chunksize - (int)sizeof(zonechunk_t);
+    block->user = 0;
+    block->tag = 0;
+    block->id = 0;
+
+    // at the end of the block list
+    chunk->head.prev = mainzone->blocklist.prev;
+    chunk->head.next = block;
+    block->prev = &chunk->head;
+    block->next = &mainzone->blocklist;
+    mainzone->blocklist.prev->next = &chunk->head;
+    mainzone->blocklist.prev = block;
+
+    Z_LinkFree(block);
+
+    return block;
+}
+
+
+static doom_boolean Z_InChunk(zonechunk_t* chunk, memblock_t* block)
+{
+    return (byte*)block >= (byte*)chunk
+        && (byte*)block < (byte*)chunk + chunk->size;
+}
+
+
+//
+// Z_ReleaseChunks
+// Gives back every added chunk that holds nothing
+//  but free and purgable blocks.
+//
+void Z_ReleaseChunks(void)
+{
+    zonechunk_t** link;
+    zonechunk_t* chunk;
+    memblock_t* block;
+    memblock_t* next;
+
+    link = &mainzone->chunks;
+
+    while ((chunk = *link) != 0)
+    {
+        for (block = chunk->head.next; Z_InChunk(chunk, block); block = block->next)
+        {
+            if (block->user && block->tag < PU_PURGELEVEL)
+                break;
+        }
+
+        if (Z_InChunk(chunk, block))
+        {
+            // still in use
+            link = &chunk->next;
+            continue;
+        }
+
+        for (block = chunk->head.next; Z_InChunk(chunk, block); block = next)
+        {
+            // get link before freeing
+            next = block->next;
+
+            if (block->user)
+                Z_FreeBlock(block);
+        }
+
+        // now a single free block
+        block = chunk->head.next;
+        Z_UnlinkFree(block);
+
+        chunk->head.prev->next = block->next;
+        block->next->prev = chunk->head.prev;
+
+        if (Z_InChunk(chunk, mainzone->rover))
+            mainzone->rover = block->next;
+
+        *link = chunk->next;
+        mainzone->size -= chunk->size;
+        doom_free(chunk);
+    }
+}
+
+
+//
+// Z_Malloc
+// You can pass a 0 user if the tag is < PU_PURGELEVEL.
+//
+void* Z_Malloc(int size, int tag, void* user)
+{
+    int extra;
+    memblock_t* newblock;
+    memblock_t* base;
+
+    size = (size + 3) & ~3;
+
+    // account for size of block header
+    size += sizeof(memblock_t);
+
+    // Take a free block that fits. If there is none, grow
+    //  the zone while it is small, then throw out purgable
+    //  blocks, and only then grow it up to the maximum.
+    base = Z_FindFree(size);
+    if (!base && mainzone->size < mainzone->softsize)
+        base = Z_AddChunk(size);
+    if (!base)
+        base = Z_PurgeFor(size);
+    if (!base)
+        base = Z_AddChunk(size);
+
+    if (!base)
+    {
+        //I_Error("Error: Z_Malloc: failed on allocation of %i bytes", size);
+        doom_strcpy(error_buf, "Error: Z_Malloc: failed on allocation of ");
+        doom_concat(error_buf, doom_itoa(size, 10));
+        doom_concat(error_buf, " bytes");
+        I_Error(error_buf);
+    }
+
+    Z_UnlinkFree(base);
+
+    // found a block big enough
+    extra = base->size - size;
+
+    if (extra > MINFRAGMENT)
+    {
+        // there will be a free fragment after the allocated block
+        newblock = (memblock_t*)((byte*)base + size);
+        newblock->size = extra;
+
+        // 0 indicates free block.
+        newblock->user = 0;
+        newblock->tag = 0;
+        newblock->prev = base;
+        newblock->next = base->next;
+        newblock->next->prev = newblock;
+
+        base->next = newblock;
+        base->size = size;
+
+        Z_LinkFree(newblock);
+    }
+
+    if (user)
+    {
+        // mark as an in use block
+        base->user = user;
+        *(void**)user = (void*)((byte*)base + sizeof(memblock_t));
+    }
+    else
+    {
+        if (tag >= PU_PURGELEVEL)
+            I_Error("Error: Z_Malloc: an owner is required for purgable blocks");
+
+        // mark as in use, but unowned        
+        base->user = (void*)2;
+    }
+    base->tag = tag;
+
+    // purging will start looking here
+    mainzone->rover = base->next;
+
+    base->id = ZONEID;
+
+    zonemallocs++;
+
+    return (void*)((byte*)base + sizeof(memblock_t));
+}
+
+
+#endif
+
+
 //
 // Z_FreeTags
 //
@@ -48418,6 +53594,11 @@ void Z_FreeTags(int lowtag, int hightag)
         if (block->tag >= lowtag && block->tag <= hightag)
             Z_Free((byte*)block + sizeof(memblock_t));
     }
+
+#if !defined(DOOM_CLASSIC_ZONE)
+    // a level change is a good time to shrink back
+    Z_ReleaseChunks();
+#endif
 }
 
 
@@ -48467,7 +53648,8 @@ void Z_DumpHeap(int lowtag, int hightag)
             break;
         }
 
-        if ((byte*)block + block->size != (byte*)block->next)
+        if ((byte*)block + block->size != (byte*)block->next
+            && block->next->id != ZONECHUNKID)
             doom_print("ERROR: block size does not touch the next block\n");
 
         if (block->next->prev != block)
@@ -48514,7 +53696,8 @@ void Z_FileDumpHeap(void* f)
             break;
         }
 
-        if ((byte*)block + block->size != (byte*)block->next)
+        if ((byte*)block + block->size != (byte*)block->next
+            && block->next->id != ZONECHUNKID)
             doom_fprint(f, "ERROR: block size does not touch the next block\n");
 
         if (block->next->prev != block)
@@ -48532,6 +53715,10 @@ void Z_FileDumpHeap(void* f)
 void Z_CheckHeap(void)
 {
     memblock_t* block;
+#if !defined(DOOM_CLASSIC_ZONE)
+    int free;
+    int i;
+#endif
 
     for (block = mainzone->blocklist.next; ; block = block->next)
     {
@@ -48541,7 +53728,8 @@ void Z_CheckHeap(void)
             break;
         }
 
-        if ((byte*)block + block->size != (byte*)block->next)
+        if ((byte*)block + block->size != (byte*)block->next
+            && block->next->id != ZONECHUNKID)
             I_Error("Error: Z_CheckHeap: block size does not touch the next block\n");
 
         if (block->next->prev != block)
@@ -48550,6 +53738,30 @@ void Z_CheckHeap(void)
         if (!block->user && !block->next->user)
             I_Error("Error: Z_CheckHeap: two consecutive free blocks\n");
     }
+
+#if !defined(DOOM_CLASSIC_ZONE)
+    free = 0;
+    for (block = mainzone->blocklist.next;
+         block != &mainzone->blocklist;
+         block = block->next)
+    {
+        if (!block->user)
+            free++;
+    }
+
+    for (i = 0; i < NUMZONEBINS; i++)
+    {
+        for (block = zonebins[i]; block; block = block->freenext)
+        {
+            if (block->user || Z_SizeBin(block->size) != i)
+                I_Error("Error: Z_CheckHeap: bad block in a free list\n");
+            free--;
+        }
+    }
+
+    if (free)
+        I_Error("Error: Z_CheckHeap: free block missing from the free lists\n");
+#endif
 }
 
 
@@ -41,7 +41,9 @@ int main(int argc, char** argv)
 
         while (input) {
             doom_update();
-            r.render_frame(doom_get_framebuffer(1));
+            // There's nothing new to draw while a demo is fast-forwarded.
+            if (!doom_is_seeking())
+                r.render_frame(doom_get_framebuffer(1));
         }
 
         return 0;
@@ -0,0 +1,164 @@
+//
+// DOOM TESTS
+// Each test builds the engine into itself, like src/PureDOOM.c,
+//  so it can reach everything the implementation has. None of
+//  them need an IWAD: they set up just the state they test.
+// Pass -scale <n> to run the benchmarks n times longer.
+//
+#define DOOM_IMPLEMENTATION
+#define DOOM_IMPLEMENT_PRINT
+#define DOOM_IMPLEMENT_MALLOC
+#define DOOM_IMPLEMENT_FILE_IO
+#define DOOM_IMPLEMENT_GETTIME
+#define DOOM_IMPLEMENT_EXIT
+#define DOOM_IMPLEMENT_GETENV
+#include "../src/PureDOOM.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+int testscale = 1;
+int testfailures;
+unsigned testseed = 1;
+
+
+//
+// T_Init
+// What doom_init sets up before D_DoomMain, and the zone.
+//
+static void T_Init(int argc, char** argv)
+{
+    int p;
+
+    doom_print = doom_print_impl;
+    doom_malloc = doom_malloc_impl;
+    doom_free = doom_free_impl;
+    doom_open = doom_open_impl;
+    doom_close = doom_close_impl;
+    doom_read = doom_read_impl;
+    doom_write = doom_write_impl;
+    doom_seek = doom_seek_impl;
+    doom_tell = doom_tell_impl;
+    doom_eof = doom_eof_impl;
+    doom_gettime = doom_gettime_impl;
+    doom_exit = doom_exit_impl;
+    doom_getenv = doom_getenv_impl;
+
+    myargc = argc;
+    myargv = argv;
+
+    p = M_CheckParm("-scale");
+    if (p && p < myargc - 1)
+        testscale = doom_atoi(myargv[p + 1]);
+    if (testscale < 1)
+        testscale = 1;
+
+    Z_Init();
+}
+
+
+//
+// T_Random
+// Repeatable from run to run, unlike M_Random's table
+//  it covers every 32 bit value.
+//
+static unsigned T_Random(void)
+{
+    testseed = testseed * 1664525u + 1013904223u;
+    return testseed ^ (testseed >> 16);
+}
+
+
+//
+// T_Usec
+//
+static long long T_Usec(void)
+{
+    int sec;
+    int usec;
+
+    doom_gettime(&sec, &usec);
+    return (long long)sec * 1000000 + usec;
+}
+
+
+//
+// T_WriteWad
+// A WAD file with the given lumps, one after the other.
+//
+typedef struct
+{
+    char* name;
+    void* data;
+    int size;
+} testlump_t;
+
+static void T_WriteWad(char* filename, char* type, testlump_t* lumps, int count)
+{
+    FILE* file;
+    filelump_t entry;
+    int position;
+    int i;
+
+    file = fopen(filename, "wb");
+    if (!file)
+    {
+        printf("can't write %s\n", filename);
+        exit(1);
+    }
+
+    position = 12;
+    for (i = 0; i < count; i++)
+        position += lumps[i].size;
+
+    fwrite(type, 1, 4, file);
+    fwrite(&count, 4, 1, file);
+    fwrite(&position, 4, 1, file);
+
+    for (i = 0; i < count; i++)
+        fwrite(lumps[i].data, 1, lumps[i].size, file);
+
+    position = 12;
+    for (i = 0; i < count; i++)
+    {
+        entry.filepos = position;
+        entry.size = lumps[i].size;
+        doom_memset(entry.name, 0, 8);
+        doom_strncpy(entry.name, lumps[i].name, 8);
+        fwrite(&entry, sizeof(entry), 1, file);
+        position += lumps[i].size;
+    }
+
+    fclose(file);
+}
+
+
+//
+// T_Check
+// Counts a failure, and says what it was.
+//
+static void T_Check(int ok, const char* what)
+{
+    if (ok)
+        return;
+
+    printf("FAILED: %s\n", what);
+    testfailures++;
+}
+
+
+//
+// T_Done
+// The exit code for main.
+//
+static int T_Done(void)
+{
+    if (testfailures)
+        printf("%d failed\n", testfailures);
+    else
+        printf("ok\n");
+
+    return testfailures ? 1 : 0;
+}
@@ -0,0 +1,237 @@
+//
+// DRAWERS
+// Each column and span drawer R_InitDrawers can pick has to
+//  draw exactly what the reference R_DrawColumn and R_DrawSpan
+//  do, for random runs, steps and offsets. Then each is timed
+//  over whole screen rows and columns.
+//
+#include "doomtest.h"
+
+#define CHECKS 20000
+#define BENCHSPANS 100000
+#define BENCHCOLUMNS 200000
+
+typedef struct
+{
+    const char* name;
+    void (*draw)(void);
+} drawer_t;
+
+byte screen[SCREENWIDTH * SCREENHEIGHT];
+byte expect[SCREENWIDTH * SCREENHEIGHT];
+
+// The AVX2 span drawer reads the three bytes before
+//  the flat and the colormap, see R_DrawSpanAVX2.
+byte flatbuf[4 + 64 * 64];
+byte texturebuf[4 + 128];
+byte colormapbuf[4 + 256];
+
+
+//
+// T_SetupDrawers
+//
+static void T_SetupDrawers(void)
+{
+    int i;
+
+    for (i = 0; i < SCREENHEIGHT; i++)
+        ylookup[i] = screen + i * SCREENWIDTH;
+    for (i = 0; i < SCREENWIDTH; i++)
+        columnofs[i] = i;
+
+    for (i = 0; i < (int)sizeof(flatbuf); i++)
+        flatbuf[i] = T_Random();
+    for (i = 0; i < (int)sizeof(texturebuf); i++)
+        texturebuf[i] = T_Random();
+    for (i = 0; i < (int)sizeof(colormapbuf); i++)
+        colormapbuf[i] = T_Random();
+
+    ds_source = flatbuf + 4;
+    ds_colormap = colormapbuf + 4;
+    dc_source = texturebuf + 4;
+    dc_colormap = colormapbuf + 4;
+    centery = SCREENHEIGHT / 2;
+}
+
+
+//
+// T_RandomSpan
+//
+static void T_RandomSpan(void)
+{
+    ds_y = T_Random() % SCREENHEIGHT;
+    ds_x1 = T_Random() % SCREENWIDTH;
+    ds_x2 = ds_x1 + T_Random() % (SCREENWIDTH - ds_x1);
+    ds_xfrac = T_Random();
+    ds_yfrac = T_Random();
+
+    // mostly the small steps of real planes, some wrapping ones
+    if (T_Random() & 3)
+    {
+        ds_xstep = (int)(T_Random() % (8 << FRACBITS)) - (4 << FRACBITS);
+        ds_ystep = (int)(T_Random() % (8 << FRACBITS)) - (4 << FRACBITS);
+    }
+    else
+    {
+        ds_xstep = T_Random();
+        ds_ystep = T_Random();
+    }
+}
+
+
+//
+// T_RandomColumn
+//
+static void T_RandomColumn(void)
+{
+    dc_x = T_Random() % SCREENWIDTH;
+    dc_yl = T_Random() % SCREENHEIGHT;
+    dc_yh = dc_yl + T_Random() % (SCREENHEIGHT - dc_yl);
+    dc_iscale = T_Random() % (4 << FRACBITS) + 1;
+    dc_texturemid = T_Random();
+}
+
+
+//
+// T_CheckDrawer
+// Draws the same random runs with the reference and the
+//  variant over the same random screen.
+//
+static void T_CheckDrawer(drawer_t* reference, drawer_t* variant,
+                          void (*setup)(void))
+{
+    char what[80];
+    unsigned seed;
+    int i;
+    int j;
+
+    for (i = 0; i < CHECKS; i++)
+    {
+        setup();
+
+        seed = T_Random();
+        for (j = 0; j < (int)sizeof(screen); j += 64)
+            screen[j] = seed + j;
+        reference->draw();
+        doom_memcpy(expect, screen, sizeof(screen));
+
+        for (j = 0; j < (int)sizeof(screen); j += 64)
+            screen[j] = seed + j;
+        variant->draw();
+
+        if (memcmp(expect, screen, sizeof(screen)))
+        {
+            snprintf(what, sizeof(what), "%s differs from %s on run %d",
+                     variant->name, reference->name, i);
+            T_Check(false, what);
+            return;
+        }
+    }
+}
+
+
+//
+// T_BenchSpans
+// Whole screen rows, with the steps of a floor seen at an angle.
+//
+static void T_BenchSpans(drawer_t* drawer)
+{
+    long long start;
+    long long usec;
+    int count;
+    int i;
+
+    count = BENCHSPANS * testscale;
+    start = T_Usec();
+
+    for (i = 0; i < count; i++)
+    {
+        ds_y = i % SCREENHEIGHT;
+        ds_x1 = 0;
+        ds_x2 = SCREENWIDTH - 1;
+        ds_xfrac = i * 977;
+        ds_yfrac = i * 31;
+        ds_xstep = 30000;
+        ds_ystep = -12345;
+        drawer->draw();
+    }
+
+    usec = T_Usec() - start;
+    printf("%-22s %8.3f ms %8.2f Mpixels/s\n", drawer->name, usec / 1000.0,
+           usec ? (double)count * SCREENWIDTH / usec : 0.0);
+}
+
+
+//
+// T_BenchColumns
+// Whole screen columns, at the scale of a wall close up.
+//
+static void T_BenchColumns(drawer_t* drawer)
+{
+    long long start;
+    long long usec;
+    int count;
+    int i;
+
+    count = BENCHCOLUMNS * testscale;
+    start = T_Usec();
+
+    for (i = 0; i < count; i++)
+    {
+        dc_x = i % SCREENWIDTH;
+        dc_yl = 0;
+        dc_yh = SCREENHEIGHT - 1;
+        dc_iscale = 40000;
+        dc_texturemid = i;
+        drawer->draw();
+    }
+
+    usec = T_Usec() - start;
+    printf("%-22s %8.3f ms %8.2f Mpixels/s\n", drawer->name, usec / 1000.0,
+           usec ? (double)count * SCREENHEIGHT / usec : 0.0);
+}
+
+
+int main(int argc, char** argv)
+{
+    drawer_t columns[] = {
+        { "R_DrawColumn", R_DrawColumn },
+        { "R_DrawColumnBatched", R_DrawColumnBatched },
+    };
+    drawer_t spans[] = {
+        { "R_DrawSpan", R_DrawSpan },
+        { "R_DrawSpanBatched", R_DrawSpanBatched },
+#if defined(DOOM_AVX2)
+        { "R_DrawSpanAVX2", R_DrawSpanAVX2 },
+#endif
+    };
+    int numcolumns;
+    int numspans;
+    int i;
+
+    T_Init(argc, argv);
+    T_SetupDrawers();
+
+    numcolumns = sizeof(columns) / sizeof(columns[0]);
+    numspans = sizeof(spans) / sizeof(spans[0]);
+
+#if defined(DOOM_AVX2)
+    if (!R_HasAVX2())
+    {
+        printf("no AVX2, leaving out R_DrawSpanAVX2\n");
+        numspans--;
+    }
+#endif
+
+    for (i = 1; i < numcolumns; i++)
+        T_CheckDrawer(&columns[0], &columns[i], T_RandomColumn);
+    for (i = 1; i < numspans; i++)
+        T_CheckDrawer(&spans[0], &spans[i], T_RandomSpan);
+
+    for (i = 0; i < numcolumns; i++)
+        T_BenchColumns(&columns[i]);
+    for (i = 0; i < numspans; i++)
+        T_BenchSpans(&spans[i]);
+
+    return T_Done();
+}
@@ -0,0 +1,467 @@
+//
+// INTERCEPTS
+// P_PathTraverse has to call back in the same order as it
+//  did with the old closest-first rescan, stopping at the
+//  same place, for the traces of shotgun pellets and BFG
+//  tracers across an open map. Then both are timed.
+// The map is an 8192 unit square, cut into 128 unit cells
+//  by two-sided lines, with a one-sided wall here and there
+//  and a crowd of monsters.
+//
+#include "doomtest.h"
+
+#define MAPSIZE 8192
+#define CELL 128
+#define CELLS (MAPSIZE / CELL)
+#define THINGS 1000
+#define SHOOTERS 2000
+#define PELLETS 7       // A_FireShotgun
+#define TRACERS 40      // A_BFGSpray
+#define MAXLOG 4096
+
+sector_t testsector;
+mobj_t testthings[THINGS];
+
+int newlog[MAXLOG];
+int oldlog[MAXLOG];
+int* traverselog;
+int traversecount;
+
+
+//
+// T_OldTraverseIntercepts
+// The closest-first rescan P_TraverseIntercepts used to be.
+//
+static doom_boolean T_OldTraverseIntercepts(traverser_t func, fixed_t maxfrac)
+{
+    int count;
+    fixed_t dist;
+    intercept_t* scan;
+    intercept_t* in;
+
+    count = (int)(intercept_p - intercepts);
+
+    in = 0;
+
+    while (count--)
+    {
+        dist = DOOM_MAXINT;
+        for (scan = intercepts; scan < intercept_p; scan++)
+        {
+            if (scan->frac < dist)
+            {
+                dist = scan->frac;
+                in = scan;
+            }
+        }
+
+        if (dist > maxfrac)
+            return true;
+
+        if (!func(in))
+            return false;
+
+        in->frac = DOOM_MAXINT;
+    }
+
+    return true;
+}
+
+
+//
+// T_OldPathTraverse
+// P_PathTraverse as it is, but with the old rescan.
+//
+static doom_boolean T_OldPathTraverse(fixed_t x1, fixed_t y1, fixed_t x2, fixed_t y2, int flags, doom_boolean(*trav) (intercept_t*))
+{
+    fixed_t xt1;
+    fixed_t yt1;
+    fixed_t xt2;
+    fixed_t yt2;
+
+    fixed_t xstep;
+    fixed_t ystep;
+
+    fixed_t partial;
+
+    fixed_t xintercept;
+    fixed_t yintercept;
+
+    int mapx;
+    int mapy;
+
+    int mapxstep;
+    int mapystep;
+
+    int count;
+
+    earlyout = flags & PT_EARLYOUT;
+
+    validcount++;
+    if (!maxintercepts)
+        P_GrowIntercepts();
+    intercept_p = intercepts;
+
+    if (((x1 - bmaporgx) & (MAPBLOCKSIZE - 1)) == 0)
+        x1 += FRACUNIT;        // don't side exactly on a line
+
+    if (((y1 - bmaporgy) & (MAPBLOCKSIZE - 1)) == 0)
+        y1 += FRACUNIT;        // don't side exactly on a line
+
+    trace.x = x1;
+    trace.y = y1;
+    trace.dx = x2 - x1;
+    trace.dy = y2 - y1;
+
+    x1 -= bmaporgx;
+    y1 -= bmaporgy;
+    xt1 = x1 >> MAPBLOCKSHIFT;
+    yt1 = y1 >> MAPBLOCKSHIFT;
+
+    x2 -= bmaporgx;
+    y2 -= bmaporgy;
+    xt2 = x2 >> MAPBLOCKSHIFT;
+    yt2 = y2 >> MAPBLOCKSHIFT;
+
+    if (xt2 > xt1)
+    {
+        mapxstep = 1;
+        partial = FRACUNIT - ((x1 >> MAPBTOFRAC) & (FRACUNIT - 1));
+        ystep = FixedDiv(y2 - y1, doom_abs(x2 - x1));
+    }
+    else if (xt2 < xt1)
+    {
+        mapxstep = -1;
+        partial = (x1 >> MAPBTOFRAC) & (FRACUNIT - 1);
+        ystep = FixedDiv(y2 - y1, doom_abs(x2 - x1));
+    }
+    else
+    {
+        mapxstep = 0;
+        partial = FRACUNIT;
+        ystep = 256 * FRACUNIT;
+    }
+
+    yintercept = (y1 >> MAPBTOFRAC) + FixedMul(partial, ystep);
+
+
+    if (yt2 > yt1)
+    {
+        mapystep = 1;
+        partial = FRACUNIT - ((y1 >> MAPBTOFRAC) & (FRACUNIT - 1));
+        xstep = FixedDiv(x2 - x1, doom_abs(y2 - y1));
+    }
+    else if (yt2 < yt1)
+    {
+        mapystep = -1;
+        partial = (y1 >> MAPBTOFRAC) & (FRACUNIT - 1);
+        xstep = FixedDiv(x2 - x1, doom_abs(y2 - y1));
+    }
+    else
+    {
+        mapystep = 0;
+        partial = FRACUNIT;
+        xstep = 256 * FRACUNIT;
+    }
+    xintercept = (x1 >> MAPBTOFRAC) + FixedMul(partial, xstep);
+
+    // Step through map blocks.
+    // Count is present to prevent a round off error
+    // from skipping the break.
+    mapx = xt1;
+    mapy = yt1;
+
+    for (count = 0; count < 64; count++)
+    {
+        if (flags & PT_ADDLINES)
+        {
+            if (!P_BlockLinesIterator(mapx, mapy, PIT_AddLineIntercepts))
+                return false;        // early out
+        }
+
+        if (flags & PT_ADDTHINGS)
+        {
+            if (!P_BlockThingsIterator(mapx, mapy, PIT_AddThingIntercepts))
+                return false;        // early out
+        }
+
+        if (mapx == xt2
+            && mapy == yt2)
+        {
+            break;
+        }
+
+        if ((yintercept >> FRACBITS) == mapy)
+        {
+            yintercept += ystep;
+            mapx += mapxstep;
+        }
+        else if ((xintercept >> FRACBITS) == mapx)
+        {
+            xintercept += xstep;
+            mapy += mapystep;
+        }
+    }
+
+    // go through the sorted list
+    return T_OldTraverseIntercepts(trav, FRACUNIT);
+}
+
+
+//
+// PTR_LogTraverse
+// Stops at one-sided walls and at every third monster,
+//  as a pellet or tracer would, and logs what it saw.
+//
+static doom_boolean PTR_LogTraverse(intercept_t* in)
+{
+    int id;
+
+    if (in->isaline)
+        id = (int)(in->d.line - lines);
+    else
+        id = MAXLOG + (int)(in->d.thing - testthings);
+
+    if (traversecount < MAXLOG)
+        traverselog[traversecount++] = id;
+
+    if (in->isaline)
+        return in->d.line->backsector != 0;
+
+    return id % 3 != 0;
+}
+
+
+//
+// T_AddLine
+//
+static void T_AddLine(vertex_t* v1, vertex_t* v2, doom_boolean twosided)
+{
+    line_t* ld;
+
+    ld = &lines[numlines++];
+    ld->v1 = v1;
+    ld->v2 = v2;
+    ld->dx = v2->x - v1->x;
+    ld->dy = v2->y - v1->y;
+    ld->frontsector = &testsector;
+    ld->backsector = twosided ? &testsector : 0;
+
+    M_ClearBox(ld->bbox);
+    M_AddToBox(ld->bbox, v1->x, v1->y);
+    M_AddToBox(ld->bbox, v2->x, v2->y);
+}
+
+
+//
+// T_SetupMap
+//
+static void T_SetupMap(void)
+{
+    vertex_t* v;
+    mobj_t* thing;
+    int count;
+    int x;
+    int y;
+    int i;
+
+    numvertexes = (CELLS + 1) * (CELLS + 1);
+    vertexes = Z_Malloc(numvertexes * sizeof(*vertexes), PU_STATIC, 0);
+
+    for (y = 0; y <= CELLS; y++)
+    {
+        for (x = 0; x <= CELLS; x++)
+        {
+            v = &vertexes[y * (CELLS + 1) + x];
+            v->x = x * CELL * FRACUNIT;
+            v->y = y * CELL * FRACUNIT;
+        }
+    }
+
+    // one line along each side of each cell, one in 64
+    //  of those inside the map one-sided, the edge all walls
+    lines = Z_Malloc(2 * CELLS * (CELLS + 1) * sizeof(*lines), PU_STATIC, 0);
+    doom_memset(lines, 0, 2 * CELLS * (CELLS + 1) * sizeof(*lines));
+    numlines = 0;
+
+    for (y = 0; y <= CELLS; y++)
+    {
+        for (x = 0; x < CELLS; x++)
+        {
+            v = &vertexes[y * (CELLS + 1) + x];
+            T_AddLine(v, v + 1, y && y < CELLS && T_Random() % 64);
+            v = &vertexes[x * (CELLS + 1) + y];
+            T_AddLine(v, v + CELLS + 1, y && y < CELLS && T_Random() % 64);
+        }
+    }
+
+    P_CreateBlockMap();
+    blockmap = blockmaplump + 4;
+    count = bmapwidth * bmapheight * sizeof(*blockthings);
+    blockthings = Z_Malloc(count, PU_STATIC, 0);
+    doom_memset(blockthings, 0, count);
+
+    for (i = 0; i < THINGS; i++)
+    {
+        thing = &testthings[i];
+        thing->x = (CELL / 2 + T_Random() % (MAPSIZE - CELL)) * FRACUNIT;
+        thing->y = (CELL / 2 + T_Random() % (MAPSIZE - CELL)) * FRACUNIT;
+        thing->radius = (16 + T_Random() % 48) * FRACUNIT;
+
+        x = (thing->x - bmaporgx) >> MAPBLOCKSHIFT;
+        y = (thing->y - bmaporgy) >> MAPBLOCKSHIFT;
+        P_LinkBlockThing(&blockthings[y * bmapwidth + x], thing);
+    }
+}
+
+
+//
+// T_Trace
+// Along angle from x, y, with the new and old traversal.
+//
+static void T_Trace(fixed_t x, fixed_t y, angle_t angle, fixed_t range,
+                    doom_boolean old)
+{
+    fixed_t x2;
+    fixed_t y2;
+
+    angle >>= ANGLETOFINESHIFT;
+    x2 = x + (range >> FRACBITS) * finecosine[angle];
+    y2 = y + (range >> FRACBITS) * finesine[angle];
+
+    traversecount = 0;
+    traverselog = old ? oldlog : newlog;
+
+    if (old)
+        T_OldPathTraverse(x, y, x2, y2, PT_ADDLINES | PT_ADDTHINGS, PTR_LogTraverse);
+    else
+        P_PathTraverse(x, y, x2, y2, PT_ADDLINES | PT_ADDTHINGS, PTR_LogTraverse);
+}
+
+
+//
+// T_Shooter
+// Where the shooter at number stands and faces.
+//
+static void T_Shooter(int number, fixed_t* x, fixed_t* y, angle_t* angle)
+{
+    testseed = number * 7919 + 1;
+    *x = (CELL / 2 + T_Random() % (MAPSIZE - CELL)) * FRACUNIT;
+    *y = (CELL / 2 + T_Random() % (MAPSIZE - CELL)) * FRACUNIT;
+    *angle = T_Random();
+}
+
+
+//
+// T_Shot
+// Shotgun pellets or BFG tracers from the shooter at number.
+//
+static int T_Shot(int number, doom_boolean bfg, doom_boolean old)
+{
+    fixed_t x;
+    fixed_t y;
+    angle_t angle;
+    int traced;
+    int i;
+
+    T_Shooter(number, &x, &y, &angle);
+    traced = 0;
+
+    for (i = 0; i < (bfg ? TRACERS : PELLETS); i++)
+    {
+        if (bfg)
+            T_Trace(x, y, angle - ANG90 / 2 + ANG90 / TRACERS * i, 16 * 64 * FRACUNIT, old);
+        else
+            T_Trace(x, y, angle + ((T_Random() % 512 - 256) << 18), MISSILERANGE, old);
+        traced += traversecount;
+    }
+
+    return traced;
+}
+
+
+//
+// T_CheckShots
+// Each trace on its own, so the logs can be compared.
+//
+static void T_CheckShots(doom_boolean bfg)
+{
+    fixed_t x;
+    fixed_t y;
+    angle_t angle;
+    angle_t an;
+    char what[80];
+    int count;
+    int i;
+    int j;
+
+    for (i = 0; i < SHOOTERS; i++)
+    {
+        for (j = 0; j < (bfg ? TRACERS : PELLETS); j++)
+        {
+            T_Shooter(i, &x, &y, &angle);
+            if (bfg)
+                an = angle - ANG90 / 2 + ANG90 / TRACERS * j;
+            else
+                an = angle + (((angle_t)(j * 73 % 512) - 256) << 18);
+
+            T_Trace(x, y, an, bfg ? 16 * 64 * FRACUNIT : MISSILERANGE, true);
+            count = traversecount;
+            T_Trace(x, y, an, bfg ? 16 * 64 * FRACUNIT : MISSILERANGE, false);
+
+            if (count != traversecount
+                || memcmp(oldlog, newlog, count * sizeof(int)))
+            {
+                snprintf(what, sizeof(what), "%s trace %d of shooter %d calls back differently",
+                         bfg ? "BFG" : "shotgun", j, i);
+                T_Check(false, what);
+                return;
+            }
+        }
+    }
+}
+
+
+//
+// T_BenchShots
+//
+static void T_BenchShots(doom_boolean bfg)
+{
+    long long start;
+    long long sorted;
+    long long rescan;
+    long long intercepts;
+    int shots;
+    int i;
+
+    shots = SHOOTERS * testscale;
+
+    start = T_Usec();
+    for (i = 0, intercepts = 0; i < shots; i++)
+        intercepts += T_Shot(i, bfg, false);
+    sorted = T_Usec() - start;
+
+    start = T_Usec();
+    for (i = 0; i < shots; i++)
+        T_Shot(i, bfg, true);
+    rescan = T_Usec() - start;
+
+    printf("%d %s shots, %lld callbacks: sorted %.3f ms, rescan %.3f ms\n",
+           shots, bfg ? "BFG" : "shotgun", intercepts,
+           sorted / 1000.0, rescan / 1000.0);
+}
+
+
+int main(int argc, char** argv)
+{
+    T_Init(argc, argv);
+    T_SetupMap();
+
+    T_CheckShots(false);
+    T_CheckShots(true);
+
+    T_BenchShots(false);
+    T_BenchShots(true);
+
+    return T_Done();
+}
@@ -0,0 +1,201 @@
+//
+// LUMPHASH
+// W_CheckNumForName has to find the same lump as the
+//  backwards scan it replaced, for every name of an IWAD
+//  and a 30000 lump PWAD that overrides some of it and
+//  repeats names within itself, in any case, and for
+//  names that are not there. Then the startup is timed:
+//  loading the directory and hashing it, and looking up
+//  a name of every eighth lump, with both.
+//
+#include "doomtest.h"
+
+#define IWADLUMPS 2000
+#define PWADLUMPS 30000
+#define OVERRIDES 1000  // IWAD names the PWAD has again
+#define MAPLUMPS 10     // names repeated once per map
+#define MISSING 1000
+
+char* maplumpnames[MAPLUMPS] = {
+    0, "THINGS", "LINEDEFS", "SIDEDEFS", "VERTEXES",
+    "SEGS", "SSECTORS", "NODES", "SECTORS", "REJECT"
+};
+
+char lumpnames[IWADLUMPS + PWADLUMPS][9];
+
+
+//
+// T_OldCheckNumForName
+// The backwards scan W_CheckNumForName used to be.
+//
+static int T_OldCheckNumForName(char* name)
+{
+    union
+    {
+        char s[9];
+        int x[2];
+    } name8;
+
+    int v1;
+    int v2;
+    lumpinfo_t* lump_p;
+
+    doom_strncpy(name8.s, name, 8);
+    name8.s[8] = 0;
+    doom_strupr(name8.s);
+
+    v1 = name8.x[0];
+    v2 = name8.x[1];
+
+    lump_p = lumpinfo + numlumps;
+
+    while (lump_p-- != lumpinfo)
+    {
+        if (*(int*)lump_p->name == v1
+            && *(int*)&lump_p->name[4] == v2)
+        {
+            return (int)(lump_p - lumpinfo);
+        }
+    }
+
+    return -1;
+}
+
+
+//
+// T_WriteWads
+// The IWAD has IWADLUMPS names of its own. The PWAD has
+//  OVERRIDES of those again, then maps of MAPLUMPS lumps
+//  with the same names in each, and names of its own.
+//
+static void T_WriteWads(void)
+{
+    static testlump_t lumps[PWADLUMPS];
+    char* name;
+    int i;
+
+    for (i = 0; i < IWADLUMPS; i++)
+    {
+        name = lumpnames[i];
+        snprintf(name, 9, "I%07d", i);
+        lumps[i].name = name;
+        lumps[i].data = name;
+        lumps[i].size = 8;
+    }
+    T_WriteWad("lumps1.wad", "IWAD", lumps, IWADLUMPS);
+
+    for (i = 0; i < PWADLUMPS; i++)
+    {
+        name = lumpnames[IWADLUMPS + i];
+
+        if (i < OVERRIDES)
+            doom_strcpy(name, lumpnames[i * (IWADLUMPS / OVERRIDES)]);
+        else if (i < PWADLUMPS / 2 && (i % MAPLUMPS) == 0)
+            snprintf(name, 9, "MAP%05d", i / MAPLUMPS);
+        else if (i < PWADLUMPS / 2)
+            doom_strcpy(name, maplumpnames[i % MAPLUMPS]);
+        else
+            snprintf(name, 9, "P%07d", i);
+
+        lumps[i].name = name;
+        lumps[i].data = name;
+        lumps[i].size = 8;
+    }
+    T_WriteWad("lumps2.wad", "PWAD", lumps, PWADLUMPS);
+}
+
+
+//
+// T_CheckNames
+//
+static void T_CheckNames(void)
+{
+    char name[9];
+    char what[80];
+    int i;
+
+    for (i = 0; i < IWADLUMPS + PWADLUMPS; i++)
+    {
+        // lower case, as the game asks for some of them
+        doom_strcpy(name, lumpnames[i]);
+        if (i & 1)
+            name[0] += 'a' - 'A';
+
+        if (W_CheckNumForName(name) != T_OldCheckNumForName(name))
+        {
+            snprintf(what, sizeof(what), "%s found at a different lump", name);
+            T_Check(false, what);
+            return;
+        }
+    }
+
+    for (i = 0; i < MISSING; i++)
+    {
+        snprintf(name, sizeof(name), "X%07d", i);
+        T_Check(W_CheckNumForName(name) == -1, "found a lump that isn't there");
+    }
+
+    // the PWAD's copy wins
+    T_Check(W_CheckNumForName(lumpnames[0]) == IWADLUMPS,
+            "the PWAD doesn't override the IWAD");
+    T_Check(W_CheckNumForName("THINGS") == T_OldCheckNumForName("THINGS")
+            && W_CheckNumForName("THINGS") >= IWADLUMPS + PWADLUMPS / 2 - MAPLUMPS,
+            "THINGS isn't the last map's");
+}
+
+
+//
+// T_TimeLookups
+//
+static long long T_TimeLookups(int (*lookup)(char* name))
+{
+    long long start;
+    int i;
+    int j;
+
+    start = T_Usec();
+
+    for (j = 0; j < testscale; j++)
+    {
+        for (i = 0; i < IWADLUMPS + PWADLUMPS; i += 8)
+            lookup(lumpnames[i]);
+    }
+
+    return T_Usec() - start;
+}
+
+
+int main(int argc, char** argv)
+{
+    char* files[] = { "lumps1.wad", "lumps2.wad", 0 };
+    long long start;
+    long long load;
+    long long hash;
+    long long hashed;
+    long long scanned;
+
+    T_Init(argc, argv);
+    T_WriteWads();
+
+    start = T_Usec();
+    W_InitMultipleFiles(files);
+    load = T_Usec() - start;
+
+    start = T_Usec();
+    W_HashLumps();
+    hash = T_Usec() - start;
+
+    T_Check(numlumps == IWADLUMPS + PWADLUMPS, "lumps missing");
+    T_CheckNames();
+
+    hashed = T_TimeLookups(W_CheckNumForName);
+    scanned = T_TimeLookups(T_OldCheckNumForName);
+
+    printf("%d lumps: W_InitMultipleFiles %.3f ms, W_HashLumps again %.3f ms\n",
+           numlumps, load / 1000.0, hash / 1000.0);
+    printf("%d lookups: hashed %.3f ms, scanned %.3f ms\n",
+           (IWADLUMPS + PWADLUMPS + 7) / 8 * testscale,
+           hashed / 1000.0, scanned / 1000.0);
+
+    return T_Done();
+}
@@ -0,0 +1,254 @@
+//
+// PLANES
+// R_DrawPlanes split into bands of rows over the workers
+//  (-rplanes) has to draw exactly what a serial R_DrawPlanes
+//  does, and this times both.
+// Without an IWAD the views are made up: rooms of sectors
+//  across the screen, each with its own floor and ceiling,
+//  like the open areas of E1M1. With DOOMWADDIR set to where
+//  doom.wad or doom1.wad is, it draws the planes of real views
+//  instead: from the player starts of E1M1 and E1M7, turning
+//  45 degrees at a time.
+// -workers <n> sets how many workers, 4 by default.
+//
+#include "doomtest.h"
+
+#define FLATS 8
+#define ROOMS 12
+#define VIEWS 8
+#define DRAWS 50
+
+byte serialscreen[SCREENWIDTH * SCREENHEIGHT];
+long long serialusec;
+long long rowsusec;
+
+
+//
+// T_TimePlanes
+// Draws the visplanes of the current view DRAWS times
+//  with the given number of workers.
+//
+static long long T_TimePlanes(int workers)
+{
+    long long start;
+    int i;
+
+    refreshworkers = workers;
+    start = T_Usec();
+
+    for (i = 0; i < DRAWS * testscale; i++)
+        R_DrawPlanes();
+
+    return T_Usec() - start;
+}
+
+
+//
+// T_CheckView
+// Serial, then in bands of rows, over the same visplanes.
+//
+static void T_CheckView(char* name, int workers)
+{
+    long long serial;
+    long long rows;
+    char what[80];
+
+    doom_memset(screens[0], 0, SCREENWIDTH * SCREENHEIGHT);
+    serial = T_TimePlanes(1);
+    doom_memcpy(serialscreen, screens[0], SCREENWIDTH * SCREENHEIGHT);
+
+    doom_memset(screens[0], 0, SCREENWIDTH * SCREENHEIGHT);
+    rows = T_TimePlanes(workers);
+
+    snprintf(what, sizeof(what), "%s: rows differ from serial", name);
+    T_Check(!memcmp(serialscreen, screens[0], SCREENWIDTH * SCREENHEIGHT), what);
+
+    printf("%-10s %4d planes  serial %8.3f ms  rows %8.3f ms\n",
+           name, (int)(lastvisplane - visplanes),
+           serial / 1000.0 / (DRAWS * testscale),
+           rows / 1000.0 / (DRAWS * testscale));
+
+    serialusec += serial;
+    rowsusec += rows;
+}
+
+
+//
+// T_AddPlane
+// Columns x1 to x2 of a plane, from row top to row bottom,
+//  which bend a little so every row gets its own spans.
+//
+static void T_AddPlane(fixed_t height, int picnum, int light,
+                       int x1, int x2, int top, int bottom)
+{
+    visplane_t* pl;
+    int x;
+    int bend;
+
+    pl = R_FindPlane(height, picnum, light);
+
+    for (x = x1; x <= x2; x++)
+    {
+        bend = (x - x1) * 8 / (x2 - x1 + 1);
+        pl->top[x] = top + (top ? bend : 0);
+        pl->bottom[x] = bottom - (bottom < viewheight - 1 ? bend : 0);
+    }
+
+    if (x1 < pl->minx)
+        pl->minx = x1;
+    if (x2 > pl->maxx)
+        pl->maxx = x2;
+}
+
+
+//
+// T_MadeUpViews
+//
+static void T_MadeUpViews(int workers)
+{
+    static byte flats[FLATS][64 * 64];
+    static byte colormap[(NUMCOLORMAPS + 2) * 256];
+    testlump_t lumps[FLATS + 3];
+    char names[FLATS][9];
+    char name[20];
+    fixed_t floor;
+    fixed_t ceiling;
+    int view;
+    int room;
+    int x1;
+    int x2;
+    int horizon;
+    int i;
+
+    // a WAD with just the flats and colormaps
+    for (i = 0; i < (int)sizeof(colormap); i++)
+        colormap[i] = (i & 255) * (NUMCOLORMAPS + 2 - i / 256) / (NUMCOLORMAPS + 2);
+    for (i = 0; i < FLATS * 64 * 64; i++)
+        flats[i / 4096][i % 4096] = T_Random();
+
+    lumps[0].name = "COLORMAP";
+    lumps[0].data = colormap;
+    lumps[0].size = sizeof(colormap);
+    lumps[1].name = "F_START";
+    lumps[1].data = 0;
+    lumps[1].size = 0;
+    for (i = 0; i < FLATS; i++)
+    {
+        snprintf(names[i], sizeof(names[i]), "FLAT%d", i);
+        lumps[2 + i].name = names[i];
+        lumps[2 + i].data = flats[i];
+        lumps[2 + i].size = 64 * 64;
+    }
+    lumps[FLATS + 2].name = "F_END";
+    lumps[FLATS + 2].data = 0;
+    lumps[FLATS + 2].size = 0;
+
+    T_WriteWad("planes.wad", "IWAD", lumps, FLATS + 3);
+    wadfiles[0] = "planes.wad";
+    W_InitMultipleFiles(wadfiles);
+
+    R_InitFlats();
+    R_InitColormaps();
+    R_InitDrawers();
+    R_InitTables();
+    R_InitLightTables();
+    skyflatnum = -1;
+    planerows = true;
+
+    V_Init();
+    R_SetViewSize(11, 0);
+    R_ExecuteSetViewSize();
+
+    for (view = 0; view < VIEWS; view++)
+    {
+        viewx = T_Random() & ~0xffff;
+        viewy = T_Random() & ~0xffff;
+        viewz = 41 * FRACUNIT;
+        viewangle = (angle_t)view * ANG45;
+        R_ClearStrips();
+        R_ClearPlanes();
+
+        // rooms across the screen, near and far, with the
+        //  walls between their floors and ceilings left out
+        for (room = 0; room < ROOMS; room++)
+        {
+            x1 = room * viewwidth / ROOMS;
+            x2 = (room + 1) * viewwidth / ROOMS - 1;
+            horizon = 10 + T_Random() % 50;
+            floor = ((int)(T_Random() % 64) - 32) * FRACUNIT;
+            ceiling = floor + (72 + T_Random() % 128) * FRACUNIT;
+
+            T_AddPlane(ceiling, T_Random() % FLATS, 96 + T_Random() % 160,
+                       x1, x2, 0, centery - horizon);
+            T_AddPlane(floor, T_Random() % FLATS, 96 + T_Random() % 160,
+                       x1, x2, centery + horizon, viewheight - 1);
+        }
+
+        snprintf(name, sizeof(name), "view %d", view);
+        T_CheckView(name, workers);
+    }
+}
+
+
+//
+// T_LevelViews
+//
+static void T_LevelViews(int workers, int map)
+{
+    player_t* player;
+    char name[20];
+    int view;
+
+    G_InitNew(sk_medium, 1, map);
+
+    player = &players[consoleplayer];
+    player->viewz = player->mo->z + VIEWHEIGHT;
+
+    for (view = 0; view < VIEWS; view++)
+    {
+        R_RenderPlayerView(player);
+
+        snprintf(name, sizeof(name), "E1M%d %d", map, view * 45);
+        T_CheckView(name, workers);
+
+        player->mo->angle += ANG45;
+    }
+}
+
+
+int main(int argc, char** argv)
+{
+    char* args[] = { argv[0], "-warp", "1", "1", "-rplanes", "-nosound", "-nomusic" };
+    int workers;
+    int p;
+
+    T_Init(argc, argv);
+
+    workers = 4;
+    p = M_CheckParm("-workers");
+    if (p && p < myargc - 1)
+        workers = doom_atoi(myargv[p + 1]);
+
+    I_InitWorkers(workers);
+    if (workers > numworkers)
+        workers = numworkers;
+    printf("%d workers\n", workers);
+
+    if (doom_getenv("DOOMWADDIR"))
+    {
+        doom_init(sizeof(args) / sizeof(args[0]), args, 0);
+        R_SetViewSize(11, 0);
+        R_ExecuteSetViewSize();
+
+        T_LevelViews(workers, 1);
+        T_LevelViews(workers, 7);
+    }
+    else
+        T_MadeUpViews(workers);
+
+    printf("all views: serial %.3f ms, rows %.3f ms, %.2fx\n",
+           serialusec / 1000.0, rowsusec / 1000.0,
+           rowsusec ? (double)serialusec / rowsusec : 0.0);
+
+    return T_Done();
+}
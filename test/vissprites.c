@@ -0,0 +1,165 @@
+//
+// VISSPRITES
+// R_SortVisSprites has to link the vissprites in the same
+//  order as the selection sort it replaced, equal scales
+//  included. Then both are timed on scenes of 100, 1000
+//  and 5000 sprites.
+//
+#include "doomtest.h"
+
+#define CHECKS 2000
+#define SORTS 200000 // vissprites sorted per scene size and timing
+
+vissprite_t* oldsorted[5000];
+
+
+//
+// T_OldSortVisSprites
+// The selection sort R_SortVisSprites used to be, leaving
+//  its order in oldsorted instead of relinking the list.
+//
+static void T_OldSortVisSprites(void)
+{
+    int i;
+    int count;
+    vissprite_t* ds;
+    vissprite_t* best;
+    vissprite_t unsorted;
+    fixed_t bestscale;
+
+    count = (int)(vissprite_p - vissprites);
+
+    unsorted.next = unsorted.prev = &unsorted;
+
+    if (!count)
+        return;
+
+    for (ds = vissprites; ds < vissprite_p; ds++)
+    {
+        ds->next = ds + 1;
+        ds->prev = ds - 1;
+    }
+
+    vissprites[0].prev = &unsorted;
+    unsorted.next = &vissprites[0];
+    (vissprite_p - 1)->next = &unsorted;
+    unsorted.prev = vissprite_p - 1;
+
+    best = 0;
+    for (i = 0; i < count; i++)
+    {
+        bestscale = DOOM_MAXINT;
+        for (ds = unsorted.next; ds != &unsorted; ds = ds->next)
+        {
+            if (ds->scale < bestscale)
+            {
+                bestscale = ds->scale;
+                best = ds;
+            }
+        }
+        best->next->prev = best->prev;
+        best->prev->next = best->next;
+        oldsorted[i] = best;
+    }
+}
+
+
+//
+// T_MakeScene
+// Things from 16 to 4096 units away, as R_ProjectSprite
+//  scales them. Some stand in groups at the same distance,
+//  so there are plenty of equal scales.
+//
+static void T_MakeScene(int count)
+{
+    vissprite_t* vis;
+    fixed_t distance;
+    int i;
+
+    R_ClearSprites();
+    distance = FRACUNIT;
+
+    for (i = 0; i < count; i++)
+    {
+        if (T_Random() % 3)
+            distance = (16 + T_Random() % 4080) * FRACUNIT;
+
+        vis = R_NewVisSprite();
+        vis->scale = FixedDiv(160 * FRACUNIT, distance);
+    }
+}
+
+
+//
+// T_CheckOrder
+//
+static void T_CheckOrder(int count)
+{
+    vissprite_t* ds;
+    char what[80];
+    int i;
+
+    T_MakeScene(count);
+    T_OldSortVisSprites();
+    R_SortVisSprites();
+
+    for (ds = vsprsortedhead.next, i = 0; i < count; ds = ds->next, i++)
+    {
+        if (ds != oldsorted[i])
+            break;
+    }
+
+    snprintf(what, sizeof(what), "%d vissprites sort differently", count);
+    T_Check(i == count && ds == &vsprsortedhead, what);
+}
+
+
+//
+// T_BenchSort
+//
+static void T_BenchSort(int count)
+{
+    long long start;
+    long long radix;
+    long long old;
+    int sorts;
+    int i;
+
+    T_MakeScene(count);
+
+    sorts = SORTS * testscale / count;
+    start = T_Usec();
+    for (i = 0; i < sorts; i++)
+        R_SortVisSprites();
+    radix = T_Usec() - start;
+
+    // quadratic, so fewer of them
+    sorts = sorts > 10 ? sorts / 10 : 1;
+    start = T_Usec();
+    for (i = 0; i < sorts; i++)
+        T_OldSortVisSprites();
+    old = T_Usec() - start;
+
+    printf("%5d vissprites  radix %9.3f us  selection %11.3f us\n", count,
+           (double)radix / (SORTS * testscale / count),
+           (double)old / sorts);
+}
+
+
+int main(int argc, char** argv)
+{
+    int i;
+
+    T_Init(argc, argv);
+
+    for (i = 0; i < CHECKS; i++)
+        T_CheckOrder(T_Random() % 300);
+    T_CheckOrder(1000);
+    T_CheckOrder(5000);
+
+    T_BenchSort(100);
+    T_BenchSort(1000);
+    T_BenchSort(5000);
+
+    return T_Done();
+}